@@ -0,0 +1,407 @@
+﻿// Замеры производительности R_K и cubic_spline. Вывод - таблица на экран и, по --json FILE,
+// файл в формате Google Benchmark (context + benchmarks), чтобы сравнивать версии между собой.
+// Число выделений памяти на итерацию считается подменой глобальных operator new/delete.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "frk_vm.h"
+#include "rk_batch.h"
+#include "rk_tableau.h"
+#include "rk_symplectic.h"
+#include "rk_events.h"
+#include "parareal.h"
+#include "rk_dense.h"
+#include "lyapunov.h"
+#include "rk_precision.h"
+#include "spline.h"
+#include "spline_stream.h"
+#include "decimate.h"
+#include "rk_trace.h"
+
+static std::atomic<size_t> alloc_count(0), alloc_bytes(0);
+
+// Размерные operator delete(void*, size_t) не подменяются: стандартные вызывают подменённый
+// operator delete(void*). Заданные здесь же, рядом с operator new, они встраиваются, и GCC
+// выдаёт ложное -Wmismatched-new-delete; без них GCC с -Wextra просит их определить
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wsized-deallocation"
+#endif
+
+void* operator new(size_t n) {
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	alloc_bytes.fetch_add(n, std::memory_order_relaxed);
+	RK_TRACE_ADD(rk_count_alloc, 1);
+	void* p = malloc(n ? n : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+struct bench_result {
+	std::string name;
+	size_t iterations;
+	double real_ns, cpu_ns; // на итерацию
+	double items_per_second;
+	double allocs, bytes; // на итерацию
+};
+
+struct bench_case {
+	std::string name;
+	double items; // единиц работы за итерацию (шаги, узлы, точки)
+	std::function<void()> setup; // не замеряется
+	std::function<void()> body;
+};
+
+static volatile double sink;
+
+static bench_result run_case(const bench_case& c, double min_time) {
+	if (c.setup)
+		c.setup();
+	c.body(); // прогрев
+	size_t iters = 1;
+	for (;;) {
+		size_t a0 = alloc_count.load(), b0 = alloc_bytes.load();
+		std::clock_t c0 = std::clock();
+		auto t0 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iters; ++i)
+			c.body();
+		double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		double cpu = double(std::clock() - c0) / CLOCKS_PER_SEC;
+		size_t allocs = alloc_count.load() - a0, bytes = alloc_bytes.load() - b0;
+		if (real >= min_time || iters >= (size_t(1) << 30)) {
+			bench_result r;
+			r.name = c.name;
+			r.iterations = iters;
+			r.real_ns = real * 1e9 / iters;
+			r.cpu_ns = cpu * 1e9 / iters;
+			r.items_per_second = c.items * iters / real;
+			r.allocs = double(allocs) / iters;
+			r.bytes = double(bytes) / iters;
+			return r;
+		}
+		double grow = real > 0 ? 1.4 * min_time / real : 10.;
+		iters = size_t(iters * std::min(std::max(grow, 2.), 10.)) + 1;
+	}
+}
+
+static std::string fmt(const char* f, double a) {
+	char s[64];
+	snprintf(s, sizeof(s), f, a);
+	return s;
+}
+
+static void add_cases(std::vector<bench_case>& cases) {
+	// Интегрирование: шаги в секунду для разных h, lambda, N на отрезке [0, 100]
+	const double end = 100;
+	struct rk_params { double h, lambda, N; };
+	const rk_params ps[] = { { 0.1, 3, 3 }, { 0.01, 3, 3 }, { 0.001, 3, 3 }, { 0.01, 0, 3 }, { 0.01, 10, 3 }, { 0.01, 3, 1 }, { 0.01, 3, 10 } };
+	for (size_t k = 0; k < sizeof(ps) / sizeof(ps[0]); ++k) {
+		rk_params p = ps[k];
+		std::string args = "/h:" + fmt("%g", p.h) + "/lambda:" + fmt("%g", p.lambda) + "/N:" + fmt("%g", p.N);
+		double steps = (double)R_K_steps(0, end, p.h);
+		cases.push_back({ "R_K" + args, steps, nullptr, [=] {
+			std::vector<double> res, res_v;
+			R_K(0, end, p.h, p.lambda, 1, p.N, res, res_v);
+			sink = res[res.size() / 2];
+		} });
+		cases.push_back({ "R_K_final" + args, steps, nullptr, [=] {
+			sink = R_K_final(0, end, p.h, p.lambda, 1, p.N).x;
+		} });
+		cases.push_back({ "R_K_float" + args, steps, nullptr, [=] {
+			std::vector<float> res, res_v;
+			R_K_float(0, end, p.h, p.lambda, 1, p.N, res, res_v);
+			sink = res[res.size() / 2];
+		} });
+		cases.push_back({ "R_K_mixed" + args, steps, nullptr, [=] {
+			std::vector<float> res, res_v;
+			R_K_mixed(0, end, p.h, p.lambda, 1, p.N, res, res_v);
+			sink = res[res.size() / 2];
+		} });
+		cases.push_back({ "R_K_DP/tol:1e-8" + args, steps, nullptr, [=] {
+			std::vector<double> res, res_v;
+			R_K_DP(0, end, p.h, p.lambda, 1, p.N, res, res_v, 1e-8, 1e-8);
+			sink = res[res.size() / 2];
+		} });
+	}
+	// Методы из rk_tableau.h с правой частью, встроенной на этапе компиляции
+	{
+		double steps = (double)R_K_steps(0, end, 0.01);
+		cases.push_back({ "rk_integrate/rk4/h:0.01", steps, nullptr, [=] {
+			pendulum_rhs f = { 3, 3 };
+			sink = rk_integrate<tableau_rk4>(f, 0, end, 0.01, std::array<double, 2>{ { 0, 1 } })[0];
+		} });
+		cases.push_back({ "rk_integrate/rk38/h:0.01", steps, nullptr, [=] {
+			pendulum_rhs f = { 3, 3 };
+			sink = rk_integrate<tableau_rk38>(f, 0, end, 0.01, std::array<double, 2>{ { 0, 1 } })[0];
+		} });
+		cases.push_back({ "rk_integrate/heun/h:0.01", steps, nullptr, [=] {
+			pendulum_rhs f = { 3, 3 };
+			sink = rk_integrate<tableau_heun>(f, 0, end, 0.01, std::array<double, 2>{ { 0, 1 } })[0];
+		} });
+	}
+	// События вместо траектории: точки поворота и сечение Пуанкаре
+	{
+		double steps = (double)R_K_steps(0, end, 0.01);
+		cases.push_back({ "R_K_events/v0+section/h:0.01", steps, nullptr, [=] {
+			rk_event ev[2] = { rk_make_event(ev_v_zero), rk_make_event(ev_section, 0, false, 1) };
+			std::vector<rk_event_hit> hits;
+			sink = R_K_events(0, end, 0.01, 0.3, 1, 3, ev, 2, hits).x;
+		} });
+	}
+	// Симплектические схемы, шаги в секунду
+	{
+		double steps = (double)R_K_steps(0, end, 0.1);
+		cases.push_back({ "R_K_symplectic/verlet/h:0.1/lambda:0.1", steps, nullptr, [=] {
+			sink = R_K_symplectic_into(0, end, 0.1, 0.1, 1, 3, rk_verlet, NULL, NULL).x;
+		} });
+		cases.push_back({ "R_K_symplectic/yoshida4/h:0.1/lambda:0.1", steps, nullptr, [=] {
+			sink = R_K_symplectic_into(0, end, 0.1, 0.1, 1, 3, rk_yoshida4, NULL, NULL).x;
+		} });
+	}
+	// Parareal на одной траектории: все потоки против одного R_K выше
+	{
+		double steps = (double)R_K_steps(0, end, 0.001);
+		cases.push_back({ "R_K_parareal/h:0.001/lambda:3/N:3", steps, nullptr, [=] {
+			std::vector<double> res, res_v;
+			sink = R_K_parareal(0, end, 0.001, 3, 1, 3, res, res_v).x;
+		} });
+	}
+	// Показатели Ляпунова: шаги с двумя касательными векторами в секунду
+	{
+		double steps = (double)R_K_steps(0, end, 0.01);
+		cases.push_back({ "R_K_lyapunov/renorm:10/h:0.01", steps, nullptr, [=] {
+			sink = R_K_lyapunov(0, end, 0.01, 3, 1, 3, 10).sum[0];
+		} });
+	}
+	// Плотный вывод: запросы x(t), v(t) в произвольные моменты между узлами
+	{
+		static rk_dense dense;
+		static std::vector<double> qt, qx, qv;
+		auto setup = [end] {
+			dense = R_K_dense(0, end, 0.01, 3, 1, 3);
+			std::mt19937 g(1);
+			std::uniform_real_distribution<double> u(0, end);
+			qt.resize(1 << 16);
+			for (size_t i = 0; i < qt.size(); ++i)
+				qt[i] = u(g);
+			qx.resize(qt.size());
+			qv.resize(qt.size());
+		};
+		cases.push_back({ "rk_dense/eval/queries:65536", double(1 << 16), setup, [] {
+			dense.eval(qt.data(), qt.size(), qx.data(), qv.data());
+			sink = qx[qx.size() / 2];
+		} });
+	}
+	// Пакет из 64 траекторий, шагов * траекторий в секунду
+	{
+		double steps = (double)R_K_steps(0, end, 0.01) * 64;
+		cases.push_back({ "R_K_batch/lanes:64/h:0.01", steps, nullptr, [=] {
+			rk_batch b;
+			for (int i = 0; i < 64; ++i)
+				b.add(0, -5 + 10. * i / 63, 3, 3);
+			R_K_batch_run(b, R_K_steps(0, end, 0.01), 0.01, NULL, NULL);
+			sink = b.x[0];
+		} });
+	}
+
+	// То же во float: дорожек в регистре вдвое больше
+	{
+		double steps = (double)R_K_steps(0, end, 0.01) * 64;
+		cases.push_back({ "R_K_batch_f/lanes:64/h:0.01", steps, nullptr, [=] {
+			rk_batch_f b;
+			for (int i = 0; i < 64; ++i)
+				b.add(0, -5 + 10.f * i / 63, 3, 3);
+			R_K_batch_f_run(b, R_K_steps(0, end, 0.01), 0.01, NULL, NULL);
+			sink = b.x[0];
+		} });
+	}
+
+	// Построение сплайна в зависимости от числа узлов
+	static std::vector<double> xs, ys;
+	static cubic_spline shared;
+	const size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+	for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+		size_t n = sizes[k];
+		auto data = [n] {
+			std::mt19937 g(1);
+			std::uniform_real_distribution<double> u(0.5, 1.5);
+			xs.resize(n);
+			ys.resize(n);
+			double t = 0;
+			for (size_t i = 0; i < n; ++i) {
+				t += 0.01 * u(g);
+				xs[i] = t;
+				ys[i] = sin(t);
+			}
+		};
+		cases.push_back({ "spline_build/n:" + std::to_string(n), double(n), data, [n] {
+			cubic_spline s;
+			s.build_spline(xs.data(), ys.data(), n);
+			sink = s.f(xs[n / 2]);
+		} });
+		cases.push_back({ "spline_rebuild/n:" + std::to_string(n), double(n), [n, data] { data(); shared = cubic_spline(); }, [n] {
+			shared.build_spline(xs.data(), ys.data(), n);
+			sink = shared.f(xs[n / 2]);
+		} });
+		// Те же узлы по одному в потоковый сплайн: узлов в секунду
+		cases.push_back({ "spline_stream/push/window:48/n:" + std::to_string(n), double(n), data, [n] {
+			spline_stream s(48);
+			for (size_t i = 0; i < n; ++i)
+				s.push(xs[i], ys[i]);
+			sink = s.f(xs[n / 2]);
+		} });
+		cases.push_back({ "spline_stream/push/window:48/max_knots:4096/n:" + std::to_string(n), double(n), data, [n] {
+			spline_stream s(48, 4096);
+			for (size_t i = 0; i < n; ++i)
+				s.push(xs[i], ys[i]);
+			sink = s.f(s.x_end());
+		} });
+	}
+
+	// Вычисление сплайна: задержка одного запроса и пакетный режим, упорядоченные и случайные точки
+	static std::vector<double> q, out;
+	const size_t m = 100000;
+	const size_t knots[] = { 1000, 1000000 };
+	for (size_t k = 0; k < sizeof(knots) / sizeof(knots[0]); ++k) {
+		size_t n = knots[k];
+		for (int sorted = 0; sorted < 2; ++sorted) {
+			for (int uniform = 0; uniform < 2; ++uniform) {
+				auto setup = [=] {
+					std::mt19937 g(2);
+					std::uniform_real_distribution<double> u(0.5, 1.5);
+					xs.resize(n);
+					ys.resize(n);
+					double t = 0;
+					for (size_t i = 0; i < n; ++i) {
+						t += uniform ? 0.01 : 0.01 * u(g);
+						xs[i] = t;
+						ys[i] = sin(t);
+					}
+					shared.build_spline(xs.data(), ys.data(), n);
+					q.resize(m);
+					out.resize(m);
+					std::uniform_real_distribution<double> uq(0, t);
+					for (size_t i = 0; i < m; ++i)
+						q[i] = uq(g);
+					if (sorted)
+						std::sort(q.begin(), q.end());
+				};
+				std::string args = "/n:" + std::to_string(n) + (uniform ? "/uniform" : "/nonuniform") + (sorted ? "/sorted" : "/random");
+				cases.push_back({ "spline_f" + args, double(m), setup, [] {
+					double s = 0;
+					for (size_t i = 0; i < q.size(); ++i)
+						s += shared.f(q[i]);
+					sink = s;
+				} });
+				cases.push_back({ "spline_f_batch" + args, double(m), setup, [] {
+					shared.f(q.data(), out.data(), q.size());
+					sink = out[0];
+				} });
+			}
+		}
+	}
+
+	// Прореживание траектории из 10^6 точек до 1000 столбцов
+	static std::vector<double> dt, dy;
+	static std::vector<xy_point> dout;
+	auto ddata = [] {
+		dt.resize(1000000);
+		dy.resize(dt.size());
+		for (size_t i = 0; i < dt.size(); ++i) {
+			dt[i] = i * 0.001;
+			dy[i] = sin(dt[i]) * cos(7 * dt[i]);
+		}
+	};
+	cases.push_back({ "decimate/minmax/n:1000000/columns:1000", 1e6, ddata, [] {
+		dout.clear();
+		decimate(dt.data(), dy.data(), dt.size(), 1000, decimate_minmax, dout);
+		sink = dout[1].y;
+	} });
+	cases.push_back({ "decimate/lttb/n:1000000/columns:1000", 1e6, ddata, [] {
+		dout.clear();
+		decimate(dt.data(), dy.data(), dt.size(), 1000, decimate_lttb, dout);
+		sink = dout[1].y;
+	} });
+}
+
+static void write_json(FILE* f, const std::vector<bench_result>& rs) {
+	char date[64];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	fprintf(f, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"rk_bench\",\n", date);
+#if defined(__AVX512F__)
+	fprintf(f, "    \"simd\": \"avx512\",\n");
+#elif defined(__AVX2__)
+	fprintf(f, "    \"simd\": \"avx2\",\n");
+#else
+	fprintf(f, "    \"simd\": \"none\",\n");
+#endif
+	fprintf(f, "    \"library_build_type\": \"%s\"\n  },\n  \"benchmarks\": [\n",
+#ifdef NDEBUG
+		"release"
+#else
+		"debug"
+#endif
+	);
+	for (size_t i = 0; i < rs.size(); ++i) {
+		const bench_result& r = rs[i];
+		fprintf(f, "    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n      \"iterations\": %zu,\n"
+			"      \"real_time\": %.6g,\n      \"cpu_time\": %.6g,\n      \"time_unit\": \"ns\",\n"
+			"      \"items_per_second\": %.6g,\n      \"allocs_per_iter\": %.6g,\n      \"bytes_per_iter\": %.6g\n    }%s\n",
+			r.name.c_str(), r.iterations, r.real_ns, r.cpu_ns, r.items_per_second, r.allocs, r.bytes, i + 1 < rs.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	const char* json = NULL;
+	const char* filter = NULL;
+	double min_time = 0.2;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--json") && i + 1 < argc)
+			json = argv[++i];
+		else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+			filter = argv[++i];
+		else if (!strcmp(argv[i], "--min-time") && i + 1 < argc)
+			min_time = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: rk_bench [--filter SUBSTRING] [--min-time SECONDS] [--json FILE]\n");
+			return 2;
+		}
+	}
+
+	std::vector<bench_case> cases;
+	add_cases(cases);
+	std::vector<bench_result> results;
+	printf("%-52s %14s %14s %12s %10s %12s\n", "Benchmark", "Time(ns)", "CPU(ns)", "items/s", "allocs", "bytes");
+	for (size_t i = 0; i < cases.size(); ++i) {
+		if (filter && cases[i].name.find(filter) == std::string::npos)
+			continue;
+		bench_result r = run_case(cases[i], min_time);
+		printf("%-52s %14.0f %14.0f %12.4g %10.3g %12.4g\n", r.name.c_str(), r.real_ns, r.cpu_ns, r.items_per_second, r.allocs, r.bytes);
+		fflush(stdout);
+		results.push_back(r);
+	}
+	if (json) {
+		FILE* f = fopen(json, "w");
+		if (!f) {
+			fprintf(stderr, "rk_bench: cannot write %s\n", json);
+			return 1;
+		}
+		write_json(f, results);
+		fclose(f);
+	}
+	return 0;
+}
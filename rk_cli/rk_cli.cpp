@@ -0,0 +1,372 @@
+﻿// Консольный пакетный запуск R_K без формы: параметры из командной строки или из файла заданий,
+// траектории - в файлы .rktr (двоичный формат traj_io.h) или .csv
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "frk_vm.h"
+#include "rk_symplectic.h"
+#include "rk_events.h"
+#include "rk_cache.h"
+#include "parareal.h"
+#include "lyapunov.h"
+#include "rk_precision.h"
+#include "sweep.h"
+#include "traj_io.h"
+#include "rk_trace.h"
+
+RK_TRACE_OPERATOR_NEW()
+
+struct cli_job {
+	double begin, end, h, lambda, x0dash, N;
+};
+
+static void usage() {
+	fprintf(stderr,
+		"usage: rk_cli [options]\n"
+		"  --begin B --end E --h H     integration interval and step (default 0 10 0.01)\n"
+		"  --lambda L --x0dash V --N N parameters (default 3 1 3)\n"
+		"                              each of the six may be a range from:to:count; jobs are all combinations\n"
+		"  --job FILE                  one job per line: begin end h lambda x0dash N ('#' starts a comment)\n"
+		"  --method rk4|dp|verlet|yoshida4|parareal\n"
+		"                              fixed-step R_K (default), adaptive R_K_DP, symplectic R_K_symplectic\n"
+		"                              or R_K_parareal (same points as rk4; jobs run one by one, each on all threads)\n"
+		"  --precision double|float|mixed\n"
+		"                              rk4 arithmetic: double (default), float, or float stages with double sums\n"
+		"  --accuracy                  append max |x|, |v| differences of the float and mixed rk4 trajectories\n"
+		"                              from the double one (err_x_float err_v_float err_x_mixed err_v_mixed)\n"
+		"  --tol T                     R_K_DP tolerance, atol = rtol = T (default 1e-8)\n"
+		"  --out PREFIX                write trajectory i to PREFIX<i>.rktr or PREFIX<i>.csv\n"
+		"  --format bin|csv            trajectory file format (default bin)\n"
+		"  --final                     keep only the final state (no trajectory is stored)\n"
+		"  --event v0|x2pi|section:PHI store only event states instead of the trajectory (rk4 only):\n"
+		"                              v = 0, x crossing a multiple of 2pi, N x passing PHI (mod 2pi);\n"
+		"                              may be repeated\n"
+		"  --stop                      stop each job at its first event\n"
+		"  --cache DIR                 reuse rk4 trajectories saved in DIR (must exist) and save new ones;\n"
+		"                              a longer saved run also serves shorter requests\n"
+		"  --lyapunov K                integrate tangent vectors with rk4, renormalising every K steps, and\n"
+		"                              append lyap1 lyap2 fli to each line (no trajectory is stored)\n"
+		"  --threads N                 worker threads, 0 = all cores (default 0)\n"
+		"  --pin                       pin worker i to core i\n"
+		"  --trace FILE                write counters, phase histograms and a Chrome trace to FILE and a\n"
+		"                              summary to stderr (only in builds with VM_RK_TRACE)\n"
+		"Prints one line per job: index begin end h lambda x0dash N x_end v_end, where x_end v_end is\n"
+		"the state after the last step (for --method dp, at the last output point; with --stop, at the event).\n");
+}
+
+// "a" или "from:to:count"
+static bool parse_range(const char* s, sweep_range& r) {
+	char* e;
+	r.from = r.to = strtod(s, &e);
+	r.count = 1;
+	if (*e == '\0')
+		return e != s;
+	if (*e != ':')
+		return false;
+	r.to = strtod(e + 1, &e);
+	if (*e != ':')
+		return false;
+	r.count = strtoul(e + 1, &e, 10);
+	return *e == '\0' && r.count > 0;
+}
+
+static bool read_jobs(const char* path, std::vector<cli_job>& jobs) {
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return false;
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		char* hash = strchr(line, '#');
+		if (hash)
+			*hash = '\0';
+		cli_job j;
+		int k = sscanf(line, "%lf %lf %lf %lf %lf %lf", &j.begin, &j.end, &j.h, &j.lambda, &j.x0dash, &j.N);
+		if (k == 6)
+			jobs.push_back(j);
+		else if (k > 0) {
+			fprintf(stderr, "rk_cli: bad job line: %s", line);
+			fclose(f);
+			return false;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	sweep_grid grid = { { 3, 3, 1 }, { 3, 3, 1 }, { 1, 1, 1 }, { 0, 0, 1 }, { 10, 10, 1 }, { 0.01, 0.01, 1 } };
+	const char* job_file = NULL;
+	const char* out = NULL;
+	const char* cache_dir = NULL;
+	const char* trace = NULL;
+	bool csv = false, dp = false, symplectic = false, parareal = false, final_only = false, pin = false;
+	rk_symplectic_method smethod = rk_yoshida4;
+	std::vector<rk_event> events;
+	bool stop = false;
+	double tol = 1e-8;
+	unsigned threads = 0;
+	size_t renorm = 0;
+	rk_precision precision = rk_prec_double;
+	bool accuracy = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* a = argv[i];
+		const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+		bool ok = true;
+		if (!strcmp(a, "--final"))
+			final_only = true;
+		else if (!strcmp(a, "--pin"))
+			pin = true;
+		else if (!strcmp(a, "--stop"))
+			stop = true;
+		else if (!strcmp(a, "--accuracy"))
+			accuracy = true;
+		else if (!strcmp(a, "--help") || !strcmp(a, "-h")) {
+			usage();
+			return 0;
+		}
+		else if (!v)
+			ok = false;
+		else {
+			++i;
+			if (!strcmp(a, "--begin"))
+				ok = parse_range(v, grid.begin);
+			else if (!strcmp(a, "--end"))
+				ok = parse_range(v, grid.end);
+			else if (!strcmp(a, "--h"))
+				ok = parse_range(v, grid.h);
+			else if (!strcmp(a, "--lambda"))
+				ok = parse_range(v, grid.lambda);
+			else if (!strcmp(a, "--x0dash"))
+				ok = parse_range(v, grid.x0dash);
+			else if (!strcmp(a, "--N"))
+				ok = parse_range(v, grid.N);
+			else if (!strcmp(a, "--job"))
+				job_file = v;
+			else if (!strcmp(a, "--method")) {
+				dp = !strcmp(v, "dp");
+				symplectic = !strcmp(v, "verlet") || !strcmp(v, "yoshida4");
+				smethod = !strcmp(v, "verlet") ? rk_verlet : rk_yoshida4;
+				parareal = !strcmp(v, "parareal");
+				ok = dp || symplectic || parareal || !strcmp(v, "rk4");
+			}
+			else if (!strcmp(a, "--precision")) {
+				precision = !strcmp(v, "float") ? rk_prec_float : !strcmp(v, "mixed") ? rk_prec_mixed : rk_prec_double;
+				ok = precision != rk_prec_double || !strcmp(v, "double");
+			}
+			else if (!strcmp(a, "--tol"))
+				tol = atof(v);
+			else if (!strcmp(a, "--out"))
+				out = v;
+			else if (!strcmp(a, "--trace"))
+				trace = v;
+			else if (!strcmp(a, "--cache"))
+				cache_dir = v;
+			else if (!strcmp(a, "--format"))
+				ok = (csv = !strcmp(v, "csv")) || !strcmp(v, "bin");
+			else if (!strcmp(a, "--event")) {
+				if (!strcmp(v, "v0"))
+					events.push_back(rk_make_event(ev_v_zero));
+				else if (!strcmp(v, "x2pi"))
+					events.push_back(rk_make_event(ev_x_2pi));
+				else if (!strncmp(v, "section:", 8))
+					events.push_back(rk_make_event(ev_section, 0, false, atof(v + 8)));
+				else
+					ok = false;
+			}
+			else if (!strcmp(a, "--lyapunov"))
+				ok = (renorm = strtoul(v, NULL, 10)) > 0;
+			else if (!strcmp(a, "--threads"))
+				threads = (unsigned)atoi(v);
+			else
+				ok = false;
+		}
+		if (!ok) {
+			fprintf(stderr, "rk_cli: bad argument %s\n", a);
+			usage();
+			return 2;
+		}
+	}
+
+#if !defined(VM_RK_TRACE)
+	if (trace) {
+		fprintf(stderr, "rk_cli: built without VM_RK_TRACE, --trace is not available\n");
+		return 2;
+	}
+#else
+	rk_trace_reset();
+#endif
+	if (renorm && (dp || symplectic || parareal || !events.empty())) {
+		fprintf(stderr, "rk_cli: --lyapunov works only with --method rk4 and without --event\n");
+		return 2;
+	}
+	if (renorm)
+		final_only = true;
+	if (precision != rk_prec_double && (dp || symplectic || parareal || renorm || cache_dir || !events.empty())) {
+		fprintf(stderr, "rk_cli: --precision works only with --method rk4 and without --event, --lyapunov, --cache\n");
+		return 2;
+	}
+	if (!events.empty() && (dp || symplectic || parareal)) {
+		fprintf(stderr, "rk_cli: --event works only with --method rk4\n");
+		return 2;
+	}
+	for (size_t e = 0; e < events.size(); ++e)
+		events[e].terminal = stop;
+
+	std::vector<cli_job> jobs;
+	if (job_file) {
+		if (!read_jobs(job_file, jobs)) {
+			fprintf(stderr, "rk_cli: cannot read %s\n", job_file);
+			return 1;
+		}
+	}
+	else {
+		for (size_t i = 0; i < grid.size(); ++i) {
+			sweep_point p = grid.at(i);
+			cli_job j = { p.begin, p.end, p.h, p.lambda, p.x0dash, p.N };
+			jobs.push_back(j);
+		}
+	}
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		if (!(jobs[i].h > 0) || !(jobs[i].end >= jobs[i].begin)) {
+			fprintf(stderr, "rk_cli: job %zu: need h > 0 and end >= begin\n", i);
+			return 2;
+		}
+	}
+
+	rk_cache cache;
+	std::mutex cache_m;
+	if (cache_dir)
+		cache.set_dir(cache_dir);
+
+	std::mutex io;
+	bool failed = false, dp_failed = false;
+	printf("# index begin end h lambda x0dash N x_end v_end%s%s\n", renorm ? " lyap1 lyap2 fli" : "",
+		accuracy ? " err_x_float err_v_float err_x_mixed err_v_mixed" : "");
+	// Parareal сам делит траекторию между потоками - задания идут по очереди
+	work_stealing_pool pool(parareal ? 1 : threads, pin);
+	pool.run(jobs.size(), [&](size_t i, unsigned) {
+		const cli_job& j = jobs[i];
+		std::vector<double> res, res_v, res_t;
+		rk_point p;
+		double l1 = 0, l2 = 0, fli = 0;
+		if (renorm) {
+			rk_lyapunov s = R_K_lyapunov(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, renorm);
+			lyapunov_exponents(s, l1, l2);
+			fli = lyapunov_fli(s);
+			p.x = s.x;
+			p.v = s.v;
+		}
+		else if (!events.empty()) {
+			std::vector<rk_event_hit> hits;
+			p = R_K_events(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, events.data(), events.size(), hits);
+			for (size_t k = 0; k < hits.size(); ++k) {
+				res_t.push_back(hits[k].t);
+				res.push_back(hits[k].x);
+				res_v.push_back(hits[k].v);
+			}
+		}
+		else if (final_only && symplectic)
+			p = R_K_symplectic_into(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, smethod, NULL, NULL);
+		else if (final_only && !dp)
+			p = R_K_final_p(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, precision);
+		else if (dp) {
+			dp_stats st = R_K_DP(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, res, res_v, tol, tol);
+			p.x = res.empty() ? j.begin : res.back();
+			p.v = res_v.empty() ? j.x0dash : res_v.back();
+			if (!st.ok) {
+				std::lock_guard<std::mutex> lock(io);
+				fprintf(stderr, "rk_cli: job %zu: R_K_DP step size underflow at t = %.17g\n", i, st.t);
+				p.x = p.v = NAN;
+				dp_failed = true;
+			}
+		}
+		else if (symplectic)
+			p = R_K_symplectic(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, res, res_v, smethod);
+		else if (parareal)
+			p = R_K_parareal(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, res, res_v, threads);
+		else if (cache_dir) {
+			rk_key k = { j.begin, j.h, j.lambda, j.x0dash, j.N };
+			rk_state s;
+			{
+				std::lock_guard<std::mutex> lock(cache_m);
+				cache.lookup(k, j.end, res, res_v, s);
+			}
+			if (s.t < j.end) {
+				R_K_extend(s, j.end, res, res_v);
+				std::lock_guard<std::mutex> lock(cache_m);
+				cache.store(s, res, res_v);
+			}
+			p.x = s.x;
+			p.v = s.v;
+		}
+		else if (precision != rk_prec_double) {
+			std::vector<float> fx, fv;
+			if (precision == rk_prec_float)
+				p = R_K_float(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, fx, fv);
+			else
+				p = R_K_mixed(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, fx, fv);
+			res.assign(fx.begin(), fx.end());
+			res_v.assign(fv.begin(), fv.end());
+		}
+		else {
+			res.resize(R_K_steps(j.begin, j.end, j.h));
+			res_v.resize(res.size());
+			p = R_K_into(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, res.data(), res_v.data());
+		}
+
+		rk_precision_report ef = {}, em = {};
+		if (accuracy) {
+			ef = rk_precision_compare(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, rk_prec_float);
+			em = rk_precision_compare(j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, rk_prec_mixed);
+		}
+
+		bool ok = true;
+		if (out && !final_only) {
+			RK_TRACE_SCOPE(rk_phase_export);
+			std::string path = std::string(out) + std::to_string(i) + (csv ? ".csv" : ".rktr");
+			if (csv) {
+				csv_writer w;
+				ok = w.open(path.c_str());
+				for (size_t k = 0; ok && k < res.size(); ++k)
+					w.push(res_t.empty() ? R_K_t(j.begin, j.h, k) : res_t[k], res[k], res_v[k]);
+				ok = w.close() && ok;
+			}
+			else {
+				traj_writer w;
+				ok = w.open(path.c_str(), traj_make_header(j.begin, j.h, j.lambda, j.x0dash, j.N), 1 << 16, false);
+				for (size_t k = 0; ok && k < res.size(); ++k)
+					w.push(res_t.empty() ? R_K_t(j.begin, j.h, k) : res_t[k], res[k], res_v[k]);
+				ok = w.close() && ok;
+			}
+			if (!ok) {
+				std::lock_guard<std::mutex> lock(io);
+				fprintf(stderr, "rk_cli: cannot write %s\n", path.c_str());
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(io);
+		failed = failed || !ok;
+		printf("%zu %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g", i, j.begin, j.end, j.h, j.lambda, j.x0dash, j.N, p.x, p.v);
+		if (renorm)
+			printf(" %.17g %.17g %.17g", l1, l2, fli);
+		if (accuracy)
+			printf(" %.3g %.3g %.3g %.3g", ef.max_x, ef.max_v, em.max_x, em.max_v);
+		printf("\n");
+	});
+#if defined(VM_RK_TRACE)
+	if (trace) {
+		rk_trace_report(stderr);
+		if (!rk_trace_write(trace)) {
+			fprintf(stderr, "rk_cli: cannot write %s\n", trace);
+			failed = true;
+		}
+	}
+#endif
+	return failed || dp_failed ? 1 : 0;
+}
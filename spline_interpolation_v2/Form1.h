@@ -1,12 +1,27 @@
 ﻿#include <fstream> 
 #include <string>
 #include "frk_vm.h"
+#include "traj_io.h"
+#include "decimate.h"
+#include "rk_async.h"
+#include "rk_cache.h"
+#include "rk_trace.h"
 #include <iostream>
 #include <iomanip>
 #include <list>
 
 #pragma once
 
+// Фоновый расчёт одной серии графика: точки из job прореживаются в decim и дорисовываются по таймеру.
+// Если известна вся траектория от начала (keep), она копится в x, v и по окончании уходит в кэш.
+struct plot_job {
+	rk_job job;
+	minmax_decimator decim;
+	int series;
+	bool keep;
+	std::vector<double> x, v;
+};
+
 namespace vm_2 {
 
   using namespace System;
@@ -21,14 +36,38 @@ namespace vm_2 {
 	public:
 	  Form1(void)  {
 	      InitializeComponent();
+		  jobs = new std::list<plot_job*>;
+		  cache = new rk_cache;
+		  poll = gcnew System::Windows::Forms::Timer();
+		  poll->Interval = 50;
+		  poll->Tick += gcnew System::EventHandler(this, &Form1::poll_Tick);
 		}
 	protected:
 	  ~Form1()  {
 		if (components)  {
 		  delete components;
 		}
+		poll->Stop();
+		for (std::list<plot_job*>::iterator it = jobs->begin(); it != jobs->end(); ++it) {
+			delete *it;
+		}
+		delete jobs;
+		delete cache;
+		delete last_run;
+		delete last_decim;
+		// В сборке с VM_RK_TRACE замеры сеанса остаются рядом с программой
+		RK_TRACE_WRITE("rk_trace.json");
 	  }
 	  int num_of_series=0;
+	  rk_state* last_run = nullptr;
+	  // Прореживание текущей серии: одно на все её продолжения, чтобы столбец на стыке не
+	  // повторялся; last_tail - сколько точек в конце серии показывают незаконченный столбец
+	  minmax_decimator* last_decim = nullptr;
+	  int last_tail = 0;
+	  double column = 1;
+	  std::list<plot_job*>* jobs;
+	  rk_cache* cache;
+	  System::Windows::Forms::Timer^ poll;
 
 	private: System::Windows::Forms::Button^  button2;
 	private: System::Windows::Forms::Label^  label3;
@@ -455,23 +494,158 @@ private: System::Void button1_Click(System::Object^ sender, System::EventArgs^ e
 		this->chart1->Series[num_of_series]->Color = Color::Black;
 	}
 
-	std::vector<double> res;
-	std::vector<double> res_v;
-	int count = 0;
-	R_K(begin, end, h, lambda, x0dash, N, res, res_v);
-	for (double i = begin; i < end; i += h) {
-		this->chart1->Series[num_of_series]->Points->AddXY(i, res[count]);
-		count++;
+	delete last_run;
+	last_run = new rk_state(R_K_start(begin, h, lambda, x0dash, N));
+	// Столбец прореживания - один пиксель графика на исходном отрезке [begin, end]
+	column = (end - begin) / (this->chart1->Width > 0 ? this->chart1->Width : 1);
+	delete last_decim;
+	last_decim = new minmax_decimator(begin, column);
+	last_tail = 0;
+	plot_run(end);
+}
+// Запускает фоновый расчёт last_run до end; новый участок дорисовывается в текущую серию
+// по таймеру, прореженный до нескольких точек на пиксель. Участок, который уже есть в кэше,
+// рисуется сразу, считается только остаток.
+private: System::Void plot_run(double end) {
+	plot_job* pj = new plot_job;
+	pj->decim = *last_decim;
+	pj->series = num_of_series;
+	// Незаконченный столбец прошлого расчёта показан временно: вместо него будет он же,
+	// дополненный новыми точками
+	Series^ series = this->chart1->Series[pj->series];
+	for (; last_tail > 0; --last_tail) {
+		series->Points->RemoveAt(series->Points->Count - 1);
+	}
+	rk_key key = { last_run->begin, last_run->h, last_run->lambda, last_run->x0dash, last_run->N };
+	rk_state s;
+	size_t shown = last_run->steps;
+	cache->lookup(key, end, pj->x, pj->v, s);
+	if (s.steps >= shown) {
+		std::vector<xy_point> pts;
+		for (size_t k = shown; k < s.steps; ++k) {
+			pj->decim.push(R_K_t(s.begin, s.h, k), pj->x[k], pts);
+		}
+		draw(pj->series, pts);
+		*last_run = s;
 	}
+	else {
+		pj->x.clear();
+		pj->v.clear();
+	}
+	pj->keep = pj->x.size() == last_run->steps;
+	pj->job.start(*last_run, end);
+	jobs->push_back(pj);
+	poll->Start();
+}
+// Переносит на график всё, что посчитано к этому моменту
+private: void drain(plot_job* pj, bool last) {
+	std::vector<double> t, x, v;
+	std::vector<xy_point> pts;
+	pj->job.take(t, x, v);
+	if (pj->keep) {
+		pj->x.insert(pj->x.end(), x.begin(), x.end());
+		pj->v.insert(pj->v.end(), v.begin(), v.end());
+	}
+	pj->decim.push(t.data(), x.data(), t.size(), pts);
+	if (last) {
+		pj->decim.flush(pts);
+	}
+	draw(pj->series, pts);
+}
+private: void draw(int n, const std::vector<xy_point>& pts) {
+	RK_TRACE_SCOPE(rk_phase_render);
+	Series^ series = this->chart1->Series[n];
+	series->Points->SuspendUpdates();
+	for (size_t k = 0; k < pts.size(); ++k) {
+		series->Points->AddXY(pts[k].x, pts[k].y);
+	}
+	series->Points->ResumeUpdates();
+}
+// Расчёт закончен или остановлен: состояние и прореживание текущей серии сохраняются для
+// продолжения, её последний столбец показывается временно
+private: void finish(plot_job* pj) {
+	bool current = pj->series == num_of_series && last_run;
+	drain(pj, !current);
+	if (current) {
+		*last_run = pj->job.state();
+		*last_decim = pj->decim;
+		std::vector<xy_point> pts;
+		last_tail = (int)last_decim->peek(pts);
+		draw(pj->series, pts);
+	}
+	if (pj->keep) {
+		cache->store(pj->job.state(), pj->x, pj->v);
+	}
+	delete pj;
+}
+private: System::Void poll_Tick(System::Object^ sender, System::EventArgs^ e) {
+	double progress = 1;
+	for (std::list<plot_job*>::iterator it = jobs->begin(); it != jobs->end();) {
+		if ((*it)->job.done()) {
+			finish(*it);
+			it = jobs->erase(it);
+			continue;
+		}
+		drain(*it, false);
+		double p = (*it)->job.progress();
+		progress = p < progress ? p : progress;
+		++it;
+	}
+	if (jobs->empty()) {
+		poll->Stop();
+		this->Errors->Text = L"";
+	}
+	else {
+		this->Errors->Text = L"Расчёт: " + Convert::ToString((int)(progress * 100)) + "%";
+	}
+}
+// Останавливает расчёт текущей серии и дорисовывает уже посчитанное
+private: void stop_current() {
+	for (std::list<plot_job*>::iterator it = jobs->begin(); it != jobs->end(); ++it) {
+		if ((*it)->series == num_of_series) {
+			(*it)->job.cancel();
+			(*it)->job.wait();
+			finish(*it);
+			jobs->erase(it);
+			return;
+		}
+	}
+}
+private: void cancel_jobs() {
+	for (std::list<plot_job*>::iterator it = jobs->begin(); it != jobs->end(); ++it) {
+		delete *it;
+	}
+	jobs->clear();
+	poll->Stop();
+	this->Errors->Text = L"";
+}
+// Совпадают ли параметры в полях ввода с последним расчётом
+private: bool same_run() {
+	if (!last_run || this->begin->Text == "" || this->H->Text == "" || this->lambda->Text == "" || this->_xdash0->Text == "" || this->N->Text == "")
+		return false;
+	return Convert::ToDouble(this->begin->Text) == last_run->begin && Convert::ToDouble(this->H->Text) == last_run->h
+		&& Convert::ToDouble(this->lambda->Text) == last_run->lambda && Convert::ToDouble(this->_xdash0->Text) == last_run->x0dash
+		&& Convert::ToDouble(this->N->Text) == last_run->N;
 }
 private: System::Void button3_Click(System::Object^ sender, System::EventArgs^ e) {
+	cancel_jobs();
 	for (int i = 0; i < num_of_series + 1; ++i) {
 		this->chart1->Series[i]->Points->Clear();
 	}
+	delete last_run;
+	last_run = nullptr;
+	delete last_decim;
+	last_decim = nullptr;
+	last_tail = 0;
 }
 private: System::Void button4_Click(System::Object^ sender, System::EventArgs^ e) {
 	this->end->Text = Convert::ToString(Convert::ToDouble(this->end->Text) + 10);
 
+	if (same_run()) {
+		stop_current();
+		plot_run(Convert::ToDouble(this->end->Text));
+		return;
+	}
 	button1_Click(sender, e);
 }
 private: System::Void button5_Click(System::Object^ sender, System::EventArgs^ e) {
@@ -493,15 +667,15 @@ private: System::Void button5_Click(System::Object^ sender, System::EventArgs^ e
 
 	std::vector<double> res;
 	std::vector<double> res_v;
-	R_K(begin, end, h, lambda, x0dash, N, res, res_v);
-	int count = 0;
-	std::ofstream ofs;
+	std::vector<double> res_t;
+	R_K(begin, end, h, lambda, x0dash, N, res, res_v, res_t);
+	RK_TRACE_SCOPE(rk_phase_export);
+	table_writer ofs;
 	ofs.open("Output.txt");
-	ofs << "x" << std::setw(20) << "v" << std::setw(20) << "t" << std::endl;
-	for (double i = begin; i < end; i += h) {
-		ofs << res[count] << std::setw(20) << res_v[count] << std::setw(20) << i << std::endl;
-		++count;
+	for (size_t count = 0; count < res.size(); ++count) {
+		ofs.push(res_t[count], res[count], res_v[count]);
 	}
+	ofs.close();
 }
 private: System::Void button6_Click(System::Object^ sender, System::EventArgs^ e) {
 	for (int i = -5; i < 6; ++i) {
@@ -0,0 +1,151 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+
+// Прореживание точек перед выводом на график: на экран уходит не больше нескольких
+// точек на столбец пикселей, сколько бы шагов ни сделал R_K.
+
+struct xy_point {
+	double x, y;
+};
+
+// Мин-макс по столбцам: ось x делится на столбцы ширины width, от каждого столбца
+// остаются первая, последняя, минимальная и максимальная точки (в порядке x) -
+// огибающая и соединения между столбцами рисуются так же, как по всем точкам.
+// Работает по мере поступления данных: готовые столбцы сразу попадают в out.
+// columns > 0 - столбцов ровно столько: точки правее последнего (в том числе правый край
+// x0 + columns * width) относятся к нему; 0 - без ограничения (данные дописываются).
+class minmax_decimator
+{
+public:
+	minmax_decimator(double _x0 = 0, double _width = 1, size_t _columns = 0) { reset(_x0, _width, _columns); }
+
+	void reset(double _x0, double _width, size_t _columns = 0) {
+		x0 = _x0;
+		width = _width > 0 ? _width : 1;
+		columns = _columns;
+		n = 0;
+	}
+
+	void push(double x, double y, std::vector<xy_point>& out) {
+		double c = floor((x - x0) / width);
+		if (columns && c > double(columns - 1))
+			c = double(columns - 1);
+		if (n && c != col)
+			flush(out);
+		xy_point p = { x, y };
+		if (!n) {
+			col = c;
+			first = lo = hi = p;
+		}
+		else {
+			if (y < lo.y)
+				lo = p;
+			if (y > hi.y)
+				hi = p;
+		}
+		last = p;
+		++n;
+	}
+
+	void push(const double* x, const double* y, size_t m, std::vector<xy_point>& out) {
+		for (size_t i = 0; i < m; ++i)
+			push(x[i], y[i], out);
+	}
+
+	// Отдаёт незаконченный столбец (в конце порции данных); следующие точки начнут его заново
+	void flush(std::vector<xy_point>& out) {
+		peek(out);
+		n = 0;
+	}
+
+	// Те же точки, что отдал бы flush, но столбец остаётся незаконченным и следующие точки
+	// дополняют его - для временного показа, пока данные ещё придут. Возвращает число точек.
+	size_t peek(std::vector<xy_point>& out) const {
+		if (!n)
+			return 0;
+		size_t from = out.size();
+		xy_point p[4] = { first, lo, hi, last };
+		if (p[1].x > p[2].x) {
+			xy_point t = p[1];
+			p[1] = p[2];
+			p[2] = t;
+		}
+		out.push_back(p[0]);
+		for (int i = 1; i < 4; ++i)
+			if (p[i].x != out.back().x)
+				out.push_back(p[i]);
+		return out.size() - from;
+	}
+
+private:
+	double x0, width, col;
+	size_t columns, n;
+	xy_point first, last, lo, hi;
+};
+
+// Largest-Triangle-Three-Buckets: target точек (не меньше 3) из n, выбирается точка
+// каждой корзины, дающая наибольший треугольник с соседями. Форма кривой сохраняется
+// лучше мин-макс при малом числе точек, но нужен весь массив сразу.
+inline void lttb(const double* x, const double* y, size_t n, size_t target, std::vector<xy_point>& out) {
+	if (target >= n || target < 3) {
+		for (size_t i = 0; i < n; ++i) {
+			xy_point p = { x[i], y[i] };
+			out.push_back(p);
+		}
+		return;
+	}
+	double every = double(n - 2) / (target - 2);
+	size_t a = 0;
+	xy_point p0 = { x[0], y[0] };
+	out.push_back(p0);
+	for (size_t i = 0; i < target - 2; ++i) {
+		// Среднее следующей корзины
+		size_t from = (size_t)((i + 1) * every) + 1, to = (size_t)((i + 2) * every) + 1;
+		if (to > n)
+			to = n;
+		double ax = 0, ay = 0;
+		for (size_t j = from; j < to; ++j) {
+			ax += x[j];
+			ay += y[j];
+		}
+		ax /= to - from;
+		ay /= to - from;
+
+		size_t lo = (size_t)(i * every) + 1, hi = (size_t)((i + 1) * every) + 1;
+		double best = -1;
+		size_t pick = lo;
+		for (size_t j = lo; j < hi; ++j) {
+			double area = fabs((x[a] - ax) * (y[j] - y[a]) - (x[a] - x[j]) * (ay - y[a]));
+			if (area > best) {
+				best = area;
+				pick = j;
+			}
+		}
+		xy_point p = { x[pick], y[pick] };
+		out.push_back(p);
+		a = pick;
+	}
+	xy_point pn = { x[n - 1], y[n - 1] };
+	out.push_back(pn);
+}
+
+enum decimate_method {
+	decimate_minmax,
+	decimate_lttb
+};
+
+// Прореживание готового массива до разрешения columns столбцов по [x[0], x[n - 1]].
+// Мин-макс даёт до 4 точек на столбец, LTTB - ровно 2 точки на столбец.
+inline void decimate(const double* x, const double* y, size_t n, size_t columns, decimate_method method, std::vector<xy_point>& out) {
+	if (!n)
+		return;
+	if (method == decimate_lttb) {
+		lttb(x, y, n, 2 * columns, out);
+		return;
+	}
+	minmax_decimator d(x[0], columns ? (x[n - 1] - x[0]) / columns : 0, columns);
+	d.push(x, y, n, out);
+	d.flush(out);
+}
@@ -1,33 +1,382 @@
-#pragma once
+﻿#pragma once
 #include <cmath>
 #include <vector>
+#include <cstddef>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "rk_trace.h"
 
-double func(double v, double x, double lambda, double N) {
+// Правая часть; каждый вызов считается в сборке с VM_RK_TRACE (rk_count_rhs), так что
+// счёт верен для любого интегратора, который через неё считает
+inline double func(double v, double x, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_rhs, 1);
 	return -1 * (lambda * v * cos(N * x) + sin(x));
 }
 
-void R_K(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v) {
+// Один шаг классического RK4 для системы x' = v, v' = func(v, x)
+inline void R_K_step(double& _dx, double& _dv, double h, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	double dx1 = h * _dv;
+	double dv1 = h * func(_dv, _dx, lambda, N);
+	double dx2 = h * (_dv + dv1 / 2);
+	double dv2 = h * func(_dv + dv1 / 2, _dx + dx1 / 
+		2, lambda, N);
+	double dx3 = h * (_dv + dv2 / 2);
+	double dv3 = h * func(_dv + dv2 / 2, _dx + dx2 / 
+		2, lambda, N);
+	double dx4 = h * (_dv + dv3);
+	double dv4 = h * func(_dv + dv3, _dx + dx3, lambda, N);
+	double dx = (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+	double dv = (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
+	_dx += dx;
+	_dv += dv;
+}
+
+// Число шагов R_K на [begin, end): точки сетки t_k = begin + k h, k = 0 .. n - 1.
+// Если (end - begin) / h отличается от целого только ошибкой округления, конец считается
+// узлом сетки (0..10 с h = 0.1 - ровно 100 шагов), иначе n берётся с избытком:
+// begin + (n - 1) h < end <= begin + n h. Число шагов не зависит от накопления суммы t += h.
+inline size_t R_K_steps(double begin, double end, double h) {
+	if (!(end > begin) || !(h > 0))
+		return 0;
+	double q = (end - begin) / h;
+	double r = floor(q + 0.5);
+	double tol = 4 * DBL_EPSILON * ((fabs(begin) + fabs(end)) / h + q);
+	if (fabs(q - r) <= tol)
+		return (size_t)r;
+	return (size_t)ceil(q);
+}
+
+// Время k-го узла сетки; считается от begin, а не накоплением, поэтому одинаково в любом месте
+inline double R_K_t(double begin, double h, size_t k) {
+	return begin + (double)k * h;
+}
+
+// Узлы сетки t_k для k = 0 .. R_K_steps(begin, end, h) - 1
+inline void R_K_times(double begin, double end, double h, std::vector<double>& t) {
+	size_t steps = R_K_steps(begin, end, h);
+	t.resize(steps);
+	for (size_t k = 0; k < steps; ++k)
+		t[k] = R_K_t(begin, h, k);
+}
+
+struct rk_point {
+	double x, v;
+};
 
+// R_K без выделения памяти: состояние перед k-м шагом пишется в xs[k * stride], vs[k * stride].
+// Буферы должны вмещать R_K_steps(begin, end, h) точек. Раздельные массивы - stride = 1,
+// чередование (x, v) в одном буфере - xs = buf, vs = buf + 1, stride = 2.
+// При xs = vs = NULL ничего не сохраняется. Возвращает состояние после последнего шага.
+inline rk_point R_K_into(double begin, double end, double h, double lambda, double x0dash, double N, double* xs, double* vs, size_t stride = 1) {
+
+	RK_TRACE_SCOPE(rk_phase_integrate);
 	double _dx = begin, _dv = x0dash;
+	size_t steps = R_K_steps(begin, end, h);
+
+	if (xs && vs) {
+		for (size_t k = 0; k < steps; ++k) {
+			xs[k * stride] = _dx;
+			vs[k * stride] = _dv;
+			R_K_step(_dx, _dv, h, lambda, N);
+		}
+	}
+	else {
+		for (size_t k = 0; k < steps; ++k)
+			R_K_step(_dx, _dv, h, lambda, N);
+	}
+	rk_point p = { _dx, _dv };
+	return p;
+}
+
+// Только конечное состояние, траектория не хранится
+inline rk_point R_K_final(double begin, double end, double h, double lambda, double x0dash, double N) {
+	return R_K_into(begin, end, h, lambda, x0dash, N, NULL, NULL);
+}
 
-	for (double i = begin; i < end; i += h) {
-		res.push_back(_dx);
-		res_v.push_back(_dv);
-		double dx1 = h * _dv;
-		double dv1 = h * func(_dv, _dx, lambda, N);
-		double dx2 = h * (_dv + dv1 / 2);
-		double dv2 = h * func(_dv + dv1 / 2, _dx + dx1 / 
-			2, lambda, N);
-		double dx3 = h * (_dv + dv2 / 2);
-		double dv3 = h * func(_dv + dv2 / 2, _dx + dx2 / 
-			2, lambda, N);
-		double dx4 = h * (_dv + dv3);
-		double dv4 = h * func(_dv + dv3, _dx + dx3, lambda, N);
-		double dx = (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
-		double dv = (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
-		_dx += dx;
-		_dv += dv;
+// Траектория в одном векторе парами (x, v)
+inline rk_point R_K_interleaved(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& xv) {
+	xv.resize(2 * R_K_steps(begin, end, h));
+	return R_K_into(begin, end, h, lambda, x0dash, N, xv.data(), xv.data() + 1, 2);
+}
+
+// Простая арена: один буфер, выделенный заранее, из которого раздаются куски под траектории.
+// reset() возвращает всю память сразу, повторные прогоны не обращаются к распределителю.
+class rk_arena
+{
+public:
+	explicit rk_arena(size_t capacity) : buf(capacity), used(0) {}
+
+	// NULL, если места не хватает
+	double* take(size_t n) {
+		if (buf.size() - used < n)
+			return NULL;
+		double* p = buf.data() + used;
+		used += n;
+		return p;
 	}
-	res.push_back(_dv);
+	void reset() { used = 0; }
+	size_t capacity() const { return buf.size(); }
+
+private:
+	std::vector<double> buf;
+	size_t used;
+};
+
+// Дописывает в res/res_v ровно R_K_steps(begin, end, h) точек - состояния в узлах t_k
+inline rk_point R_K(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v) {
+
+	size_t steps = R_K_steps(begin, end, h);
+	size_t base = res.size(), base_v = res_v.size();
+	res.resize(base + steps);
+	res_v.resize(base_v + steps);
+	return R_K_into(begin, end, h, lambda, x0dash, N, res.data() + base, res_v.data() + base_v);
+}
+
+// То же с моментами времени точек в res_t
+inline rk_point R_K(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v, std::vector<double>& res_t) {
+	size_t base = res_t.size(), steps = R_K_steps(begin, end, h);
+	res_t.resize(base + steps);
+	for (size_t k = 0; k < steps; ++k)
+		res_t[base + k] = R_K_t(begin, h, k);
+	return R_K(begin, end, h, lambda, x0dash, N, res, res_v);
+}
+
+// Состояние прерванного интегрирования R_K: по нему расчёт продолжается до нового конца
+// только на добавленном отрезке. Сделано steps шагов, t = R_K_t(begin, h, steps),
+// поэтому продолжение (в том числе кусками) совпадает с пересчётом R_K с нуля до последнего бита.
+struct rk_state {
+	double begin, x0dash;
+	double t, x, v;
+	double h, lambda, N;
+	size_t steps;
+};
+
+inline rk_state R_K_start(double begin, double h, double lambda, double x0dash, double N) {
+	rk_state s = { begin, x0dash, begin, begin, x0dash, h, lambda, N, 0 };
+	return s;
+}
+
+// Делает ещё steps шагов, дописывая в res/res_v состояния перед каждым из них
+inline void R_K_advance(rk_state& s, size_t steps, std::vector<double>& res, std::vector<double>& res_v) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	size_t base = res.size(), base_v = res_v.size();
+	res.resize(base + steps);
+	res_v.resize(base_v + steps);
+	for (size_t k = 0; k < steps; ++k) {
+		res[base + k] = s.x;
+		res_v[base_v + k] = s.v;
+		R_K_step(s.x, s.v, s.h, s.lambda, s.N);
+	}
+	s.steps += steps;
+	s.t = R_K_t(s.begin, s.h, s.steps);
+}
+
+// Дописывает в res/res_v точки от текущего s.t до end (узлы сетки R_K от s.begin) и сдвигает состояние
+inline void R_K_extend(rk_state& s, double end, std::vector<double>& res, std::vector<double>& res_v) {
+	size_t total = R_K_steps(s.begin, end, s.h);
+	R_K_advance(s, total > s.steps ? total - s.steps : 0, res, res_v);
+}
+
+// Контрольная точка состояния в двоичном виде, не зависящем от платформы:
+// "RKS2", затем begin, x0dash, t, x, v, h, lambda, N (IEEE 754 double) и steps (uint64),
+// каждое поле - 8 байт little-endian
+inline void R_K_put_u64(std::ostream& os, uint64_t u) {
+	char b[8];
+	for (int i = 0; i < 8; ++i)
+		b[i] = (char)(u >> (8 * i));
+	os.write(b, 8);
+}
+
+inline uint64_t R_K_get_u64(std::istream& is) {
+	unsigned char b[8] = { 0 };
+	is.read(reinterpret_cast<char*>(b), 8);
+	uint64_t u = 0;
+	for (int i = 0; i < 8; ++i)
+		u |= (uint64_t)b[i] << (8 * i);
+	return u;
+}
+
+inline void R_K_put_f64(std::ostream& os, double a) {
+	uint64_t u;
+	memcpy(&u, &a, sizeof(u));
+	R_K_put_u64(os, u);
 }
 
+inline double R_K_get_f64(std::istream& is) {
+	uint64_t u = R_K_get_u64(is);
+	double a;
+	memcpy(&a, &u, sizeof(a));
+	return a;
+}
+
+inline bool R_K_save(const rk_state& s, std::ostream& os) {
+	const char magic[4] = { 'R', 'K', 'S', '2' };
+	os.write(magic, sizeof(magic));
+	const double f[8] = { s.begin, s.x0dash, s.t, s.x, s.v, s.h, s.lambda, s.N };
+	for (int i = 0; i < 8; ++i)
+		R_K_put_f64(os, f[i]);
+	R_K_put_u64(os, s.steps);
+	return !os.fail();
+}
+
+inline bool R_K_load(rk_state& s, std::istream& is) {
+	char magic[4];
+	is.read(magic, sizeof(magic));
+	if (is.fail() || magic[0] != 'R' || magic[1] != 'K' || magic[2] != 'S' || magic[3] != '2')
+		return false;
+	double f[8];
+	for (int i = 0; i < 8; ++i)
+		f[i] = R_K_get_f64(is);
+	uint64_t steps = R_K_get_u64(is);
+	if (is.fail() || steps > (uint64_t)SIZE_MAX)
+		return false;
+	rk_state r = { f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], (size_t)steps };
+	s = r;
+	return true;
+}
+
+// Статистика адаптивного решателя: число вызовов func(), принятых и отброшенных шагов.
+// ok = false - шаг стал меньше допустимого (16 eps |t|) или отброшено dp_max_rejects шагов
+// подряд (например, погрешность - NaN); тогда res/res_v заполнены только до момента t.
+struct dp_stats {
+	size_t nfev;
+	size_t naccept;
+	size_t nreject;
+	bool ok;
+	double t;
+};
+
+// Сколько шагов подряд можно отбросить, прежде чем R_K_DP сдастся
+const size_t dp_max_rejects = 100;
+
+// Метод Дормана-Принса 5(4) с контролем локальной погрешности и PI-регулятором шага.
+// Параметры и начальные условия те же, что у R_K; h задаёт только сетку вывода:
+// res/res_v заполняются в узлах сетки R_K (R_K_t(begin, h, k), k < R_K_steps) по непрерывной (плотной) формуле
+// метода, сами шаги интегрирования выбираются по допускам atol/rtol.
+inline dp_stats R_K_DP(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v,
+	double atol = 1e-8, double rtol = 1e-8) {
+
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	const double a21 = 1. / 5;
+	const double a31 = 3. / 40, a32 = 9. / 40;
+	const double a41 = 44. / 45, a42 = -56. / 15, a43 = 32. / 9;
+	const double a51 = 19372. / 6561, a52 = -25360. / 2187, a53 = 64448. / 6561, a54 = -212. / 729;
+	const double a61 = 9017. / 3168, a62 = -355. / 33, a63 = 46732. / 5247, a64 = 49. / 176, a65 = -5103. / 18656;
+	const double a71 = 35. / 384, a73 = 500. / 1113, a74 = 125. / 192, a75 = -2187. / 6784, a76 = 11. / 84;
+	const double e1 = 71. / 57600, e3 = -71. / 16695, e4 = 71. / 1920, e5 = -17253. / 339200, e6 = 22. / 525, e7 = -1. / 40;
+	const double d1 = -12715105075. / 11282082432, d3 = 87487479700. / 32700410799, d4 = -10690763975. / 1880347072,
+		d5 = 701980252875. / 199316789632, d6 = -1453857185. / 822651844, d7 = 69997945. / 29380423;
+	// Параметры PI-регулятора (Hairer, Norsett, Wanner)
+	const double safe = 0.9, beta = 0.04, expo1 = 0.2 - beta * 0.75;
+	const double facc1 = 1. / 0.2, facc2 = 1. / 10.;
+
+	dp_stats st = { 0, 0, 0, true, begin };
+	double t = begin, _dx = begin, _dv = x0dash;
+	double kx1 = _dv, kv1 = func(_dv, _dx, lambda, N);
+	++st.nfev;
+
+	// Начальный шаг по оценке производных, как в hinit
+	double sk_x = atol + rtol * fabs(_dx), sk_v = atol + rtol * fabs(_dv);
+	double dnf = (kx1 / sk_x) * (kx1 / sk_x) + (kv1 / sk_v) * (kv1 / sk_v);
+	double dny = (_dx / sk_x) * (_dx / sk_x) + (_dv / sk_v) * (_dv / sk_v);
+	double step = (dnf <= 1e-10 || dny <= 1e-10) ? 1e-6 : 0.01 * sqrt(dny / dnf);
+	step = fmin(step, end - begin);
+	{
+		double x1 = _dx + step * kx1, v1 = _dv + step * kv1;
+		double kx2 = v1, kv2 = func(v1, x1, lambda, N);
+		++st.nfev;
+		double der2 = sqrt(((kx2 - kx1) / sk_x) * ((kx2 - kx1) / sk_x) + ((kv2 - kv1) / sk_v) * ((kv2 - kv1) / sk_v)) / step;
+		double der12 = fmax(fabs(der2), sqrt(dnf));
+		double step1 = der12 <= 1e-15 ? fmax(1e-6, step * 1e-3) : pow(0.01 / der12, 0.2);
+		step = fmin(fmin(100 * step, step1), end - begin);
+	}
+
+	double facold = 1e-4;
+	size_t k = 0, nout = R_K_steps(begin, end, h);
+	size_t in_row = 0;
+	bool last = false, rejected = false;
+
+	while (!last) {
+		// Шаг, неотличимый от нуля на фоне t, или NaN - дальше продвинуться нельзя
+		if (!(step >= fmax(16 * DBL_EPSILON * fabs(t), DBL_MIN)) || in_row >= dp_max_rejects) {
+			st.ok = false;
+			break;
+		}
+		if (t + 1.01 * step >= end) {
+			step = end - t;
+			last = true;
+		}
+
+		double x2 = _dx + step * a21 * kx1;
+		double v2 = _dv + step * a21 * kv1;
+		double kx2 = v2, kv2 = func(v2, x2, lambda, N);
+		double x3 = _dx + step * (a31 * kx1 + a32 * kx2);
+		double v3 = _dv + step * (a31 * kv1 + a32 * kv2);
+		double kx3 = v3, kv3 = func(v3, x3, lambda, N);
+		double x4 = _dx + step * (a41 * kx1 + a42 * kx2 + a43 * kx3);
+		double v4 = _dv + step * (a41 * kv1 + a42 * kv2 + a43 * kv3);
+		double kx4 = v4, kv4 = func(v4, x4, lambda, N);
+		double x5 = _dx + step * (a51 * kx1 + a52 * kx2 + a53 * kx3 + a54 * kx4);
+		double v5 = _dv + step * (a51 * kv1 + a52 * kv2 + a53 * kv3 + a54 * kv4);
+		double kx5 = v5, kv5 = func(v5, x5, lambda, N);
+		double x6 = _dx + step * (a61 * kx1 + a62 * kx2 + a63 * kx3 + a64 * kx4 + a65 * kx5);
+		double v6 = _dv + step * (a61 * kv1 + a62 * kv2 + a63 * kv3 + a64 * kv4 + a65 * kv5);
+		double kx6 = v6, kv6 = func(v6, x6, lambda, N);
+		double xn = _dx + step * (a71 * kx1 + a73 * kx3 + a74 * kx4 + a75 * kx5 + a76 * kx6);
+		double vn = _dv + step * (a71 * kv1 + a73 * kv3 + a74 * kv4 + a75 * kv5 + a76 * kv6);
+		double kx7 = vn, kv7 = func(vn, xn, lambda, N);
+		st.nfev += 6;
+
+		double ex = step * (e1 * kx1 + e3 * kx3 + e4 * kx4 + e5 * kx5 + e6 * kx6 + e7 * kx7);
+		double ev = step * (e1 * kv1 + e3 * kv3 + e4 * kv4 + e5 * kv5 + e6 * kv6 + e7 * kv7);
+		sk_x = atol + rtol * fmax(fabs(_dx), fabs(xn));
+		sk_v = atol + rtol * fmax(fabs(_dv), fabs(vn));
+		double err = sqrt(((ex / sk_x) * (ex / sk_x) + (ev / sk_v) * (ev / sk_v)) / 2);
+
+		double fac11 = pow(err, expo1);
+		double fac = fac11 / pow(facold, beta);
+		fac = fmax(facc2, fmin(facc1, fac / safe));
+		double step_new = step / fac;
+
+		if (err > 1. || !(err == err)) {
+			// Шаг отброшен: уменьшаем и повторяем с той же точки
+			++st.nreject;
+			++in_row;
+			last = false;
+			rejected = true;
+			step /= (err == err) ? fmin(facc1, fac11 / safe) : facc1;
+			continue;
+		}
+
+		// Коэффициенты плотной выдачи 4-го порядка
+		double rx1 = _dx, rx2 = xn - _dx, rx3 = step * kx1 - rx2, rx4 = rx2 - step * kx7 - rx3;
+		double rx5 = step * (d1 * kx1 + d3 * kx3 + d4 * kx4 + d5 * kx5 + d6 * kx6 + d7 * kx7);
+		double rv1 = _dv, rv2 = vn - _dv, rv3 = step * kv1 - rv2, rv4 = rv2 - step * kv7 - rv3;
+		double rv5 = step * (d1 * kv1 + d3 * kv3 + d4 * kv4 + d5 * kv5 + d6 * kv6 + d7 * kv7);
+
+		double t_new = last ? end : t + step;
+		for (; k < nout && R_K_t(begin, h, k) <= t_new; ++k) {
+			double th = (R_K_t(begin, h, k) - t) / step, th1 = 1 - th;
+			res.push_back(rx1 + th * (rx2 + th1 * (rx3 + th * (rx4 + th1 * rx5))));
+			res_v.push_back(rv1 + th * (rv2 + th1 * (rv3 + th * (rv4 + th1 * rv5))));
+		}
+
+		++st.naccept;
+		facold = fmax(err, 1e-4);
+		_dx = xn;
+		_dv = vn;
+		kx1 = kx7;
+		kv1 = kv7;
+		t = t_new;
+		step = rejected ? fmin(step_new, step) : step_new;
+		rejected = false;
+		in_row = 0;
+	}
+	st.t = t;
+	RK_TRACE_ADD(rk_count_steps, st.naccept);
+	RK_TRACE_ADD(rk_count_rejected, st.nreject);
+	return st;
+}
@@ -0,0 +1,171 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+#include "sweep.h"
+
+// Показатели Ляпунова вдоль траектории R_K без хранения траектории.
+// Вместе с (x, v) тем же RK4 интегрируются два касательных вектора (dx, dv):
+//   dx' = dv,  dv' = fx dx + fv dv,  fx = lambda v N sin(N x) - cos x,  fv = -lambda cos(N x).
+// Каждые renorm шагов векторы ортонормируются по Граму - Шмидту (метод Бенеттина),
+// логарифмы норм копятся: lambda_i = сумма / (t - begin). Сумма двух показателей равна
+// среднему fv вдоль траектории - удобная проверка. FLI (быстрый индикатор Ляпунова) -
+// наибольший log |w1| без нормировок за всё время.
+// Система плоская и автономная, так что на большом времени lambda1 -> 0 на предельном цикле
+// и lambda1 < 0 у устойчивого равновесия; по сетке lambda x N это и отделяет режимы.
+
+// Состояние счёта: O(1) памяти на траекторию, продолжается R_K_lyapunov_advance
+struct rk_lyapunov {
+	double begin, h, lambda, N;
+	size_t renorm;
+	size_t steps;
+	double x, v;
+	double w[2][2];  // касательные векторы (dx, dv)
+	double sum[2];   // накопленные логарифмы норм при нормировках
+	double fli;
+};
+
+// Якобиан правой части func в точке (x, v): fx = d func / dx, fv = d func / dv
+inline void rk_jacobian(double x, double v, double lambda, double N, double& fx, double& fv) {
+	fx = lambda * v * N * sin(N * x) - cos(x);
+	fv = -lambda * cos(N * x);
+}
+
+// x' = v, v' = func вместе с касательными векторами: x и v те же, что у R_K_step
+inline void R_K_tangent_step(double& _dx, double& _dv, double w[2][2], double h, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	double fx1, fv1, fx2, fv2, fx3, fv3, fx4, fv4;
+	double dx1 = h * _dv;
+	double dv1 = h * func(_dv, _dx, lambda, N);
+	rk_jacobian(_dx, _dv, lambda, N, fx1, fv1);
+	double dx2 = h * (_dv + dv1 / 2);
+	double dv2 = h * func(_dv + dv1 / 2, _dx + dx1 / 2, lambda, N);
+	rk_jacobian(_dx + dx1 / 2, _dv + dv1 / 2, lambda, N, fx2, fv2);
+	double dx3 = h * (_dv + dv2 / 2);
+	double dv3 = h * func(_dv + dv2 / 2, _dx + dx2 / 2, lambda, N);
+	rk_jacobian(_dx + dx2 / 2, _dv + dv2 / 2, lambda, N, fx3, fv3);
+	double dx4 = h * (_dv + dv3);
+	double dv4 = h * func(_dv + dv3, _dx + dx3, lambda, N);
+	rk_jacobian(_dx + dx3, _dv + dv3, lambda, N, fx4, fv4);
+	_dx += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+	_dv += (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
+
+	for (int i = 0; i < 2; ++i) {
+		double a = w[i][0], b = w[i][1];
+		double a1 = h * b, b1 = h * (fx1 * a + fv1 * b);
+		double a2 = h * (b + b1 / 2), b2 = h * (fx2 * (a + a1 / 2) + fv2 * (b + b1 / 2));
+		double a3 = h * (b + b2 / 2), b3 = h * (fx3 * (a + a2 / 2) + fv3 * (b + b2 / 2));
+		double a4 = h * (b + b3), b4 = h * (fx4 * (a + a3) + fv4 * (b + b3));
+		w[i][0] += (a1 + 2 * a2 + 2 * a3 + a4) / 6;
+		w[i][1] += (b1 + 2 * b2 + 2 * b3 + b4) / 6;
+	}
+}
+
+// Грам - Шмидт для двух векторов: после вызова они ортонормированы, в r - их длины
+// в разложении QR (|w1| и длина составляющей w2, перпендикулярной w1)
+inline void lyapunov_orthonormalize(double w[2][2], double r[2]) {
+	r[0] = hypot(w[0][0], w[0][1]);
+	w[0][0] /= r[0];
+	w[0][1] /= r[0];
+	double p = w[1][0] * w[0][0] + w[1][1] * w[0][1];
+	w[1][0] -= p * w[0][0];
+	w[1][1] -= p * w[0][1];
+	r[1] = hypot(w[1][0], w[1][1]);
+	w[1][0] /= r[1];
+	w[1][1] /= r[1];
+}
+
+// renorm - через сколько шагов нормировать касательные векторы (0 - каждый шаг)
+inline rk_lyapunov R_K_lyapunov_start(double begin, double h, double lambda, double x0dash, double N, size_t renorm = 10) {
+	rk_lyapunov s;
+	s.begin = begin;
+	s.h = h;
+	s.lambda = lambda;
+	s.N = N;
+	s.renorm = renorm ? renorm : 1;
+	s.steps = 0;
+	s.x = begin;
+	s.v = x0dash;
+	s.w[0][0] = 1;
+	s.w[0][1] = 0;
+	s.w[1][0] = 0;
+	s.w[1][1] = 1;
+	s.sum[0] = s.sum[1] = 0;
+	s.fli = 0;
+	return s;
+}
+
+// Ещё n шагов; результат не зависит от того, какими кусками вызывать
+inline void R_K_lyapunov_advance(rk_lyapunov& s, size_t n) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	for (size_t k = 0; k < n; ++k) {
+		R_K_tangent_step(s.x, s.v, s.w, s.h, s.lambda, s.N);
+		if (++s.steps % s.renorm)
+			continue;
+		double r[2];
+		lyapunov_orthonormalize(s.w, r);
+		s.sum[0] += log(r[0]);
+		s.sum[1] += log(r[1]);
+		if (s.sum[0] > s.fli)
+			s.fli = s.sum[0];
+	}
+}
+
+// Текущие оценки показателей (с учётом шагов после последней нормировки)
+inline void lyapunov_exponents(const rk_lyapunov& s, double& l1, double& l2) {
+	double T = s.steps * s.h;
+	if (!(T > 0)) {
+		l1 = l2 = 0;
+		return;
+	}
+	double w[2][2] = { { s.w[0][0], s.w[0][1] }, { s.w[1][0], s.w[1][1] } };
+	double r[2];
+	lyapunov_orthonormalize(w, r);
+	l1 = (s.sum[0] + log(r[0])) / T;
+	l2 = (s.sum[1] + log(r[1])) / T;
+}
+
+inline double lyapunov_fli(const rk_lyapunov& s) {
+	double now = s.sum[0] + log(hypot(s.w[0][0], s.w[0][1]));
+	return now > s.fli ? now : s.fli;
+}
+
+// Те же шаги, что у R_K на [begin, end)
+inline rk_lyapunov R_K_lyapunov(double begin, double end, double h, double lambda, double x0dash, double N, size_t renorm = 10) {
+	rk_lyapunov s = R_K_lyapunov_start(begin, h, lambda, x0dash, N, renorm);
+	R_K_lyapunov_advance(s, R_K_steps(begin, end, h));
+	return s;
+}
+
+// Результат одной точки сетки; index - как в sweep_result
+struct lyapunov_cell {
+	size_t index;
+	double begin, end, h;
+	double lambda, N, x0dash;
+	double l1, l2, fli;
+	double x, v;  // состояние в конце
+};
+
+// Карта показателей по сетке параметров на threads потоках (0 - по числу ядер);
+// out[i] - точка i сетки, траектории не хранятся
+inline void lyapunov_sweep(const sweep_grid& grid, std::vector<lyapunov_cell>& out, size_t renorm = 10, unsigned threads = 0) {
+	out.resize(grid.size());
+	work_stealing_pool pool(threads);
+	pool.run(grid.size(), [&](size_t i, unsigned) {
+		sweep_point p = grid.at(i);
+		lyapunov_cell& c = out[i];
+		c.index = i;
+		c.begin = p.begin;
+		c.end = p.end;
+		c.h = p.h;
+		c.lambda = p.lambda;
+		c.N = p.N;
+		c.x0dash = p.x0dash;
+		rk_lyapunov s = R_K_lyapunov(p.begin, p.end, p.h, p.lambda, p.x0dash, p.N, renorm);
+		lyapunov_exponents(s, c.l1, c.l2);
+		c.fli = lyapunov_fli(s);
+		c.x = s.x;
+		c.v = s.v;
+	});
+}
@@ -0,0 +1,99 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+#include "sweep.h"
+
+// Параллельное по времени интегрирование (Parareal) одной длинной траектории R_K.
+// Сетка R_K делится на отрезки по номерам шагов. Грубый решатель G - тот же RK4 с шагом
+// coarse * h - быстро даёт начальные состояния отрезков; точный решатель F (шаги R_K)
+// считает все отрезки параллельно, затем начальные состояния поправляются последовательно:
+//   U[i+1] = F(U[i]_old) + (G(U[i]_new) - G(U[i]_old)).
+// После k итераций первые k отрезков совпадают с R_K бит в бит, остальные - с точностью tol;
+// обычно хватает нескольких итераций, и время одной траектории делится почти на число ядер.
+
+struct parareal_stats {
+	size_t slices;
+	size_t iterations;
+	double correction; // наибольшая поправка начального состояния на последней итерации
+};
+
+// Грубый RK4 на отрезке из steps шагов сетки: шаг не больше coarse * h
+inline rk_point parareal_coarse(rk_point p, size_t steps, double h, size_t coarse, double lambda, double N) {
+	size_t c = (steps + coarse - 1) / coarse;
+	double H = steps * h / c;
+	for (size_t k = 0; k < c; ++k)
+		R_K_step(p.x, p.v, H, lambda, N);
+	return p;
+}
+
+// Точный решатель: шаги R_K от состояния p, состояния перед шагами - в xs, vs
+inline rk_point parareal_fine(rk_point p, size_t steps, double h, double lambda, double N, double* xs, double* vs) {
+	for (size_t k = 0; k < steps; ++k) {
+		xs[k] = p.x;
+		vs[k] = p.v;
+		R_K_step(p.x, p.v, h, lambda, N);
+	}
+	return p;
+}
+
+// Результат тот же, что у R_K (res/res_v - R_K_steps точек, возвращается конечное состояние).
+// threads = 0 - все ядра; slices = 0 - по отрезку на поток; max_iter = 0 - до сходимости
+// (не больше числа отрезков, после чего результат точный).
+inline rk_point R_K_parareal(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v,
+	unsigned threads = 0, size_t slices = 0, size_t coarse = 10, double tol = 1e-10, size_t max_iter = 0, parareal_stats* stats = NULL) {
+
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	work_stealing_pool pool(threads);
+	size_t steps = R_K_steps(begin, end, h);
+	size_t P = slices ? slices : pool.threads();
+	if (P > steps)
+		P = steps ? steps : 1;
+	if (!coarse)
+		coarse = 1;
+	res.resize(steps);
+	res_v.resize(steps);
+
+	std::vector<size_t> from(P + 1);
+	for (size_t i = 0; i <= P; ++i)
+		from[i] = steps * i / P;
+
+	// U[i] - начальное состояние i-го отрезка, G[i] - грубый результат отрезка от U[i], F[i] - точный
+	std::vector<rk_point> U(P + 1), G(P), F(P);
+	U[0].x = begin;
+	U[0].v = x0dash;
+	for (size_t i = 0; i < P; ++i) {
+		G[i] = parareal_coarse(U[i], from[i + 1] - from[i], h, coarse, lambda, N);
+		U[i + 1] = G[i];
+	}
+
+	size_t limit = max_iter && max_iter < P ? max_iter : P;
+	parareal_stats st = { P, 0, 0 };
+	for (size_t it = 0; it < limit; ++it) {
+		// Отрезки до it уже точные, их пересчитывать не нужно
+		pool.run(P - it, [&](size_t j, unsigned) {
+			size_t i = it + j;
+			F[i] = parareal_fine(U[i], from[i + 1] - from[i], h, lambda, N, res.data() + from[i], res_v.data() + from[i]);
+		});
+		++st.iterations;
+		st.correction = 0;
+		for (size_t i = it; i < P; ++i) {
+			rk_point g = parareal_coarse(U[i], from[i + 1] - from[i], h, coarse, lambda, N);
+			rk_point u = { F[i].x + (g.x - G[i].x), F[i].v + (g.v - G[i].v) };
+			double d = fabs(u.x - U[i + 1].x) + fabs(u.v - U[i + 1].v);
+			double scale = 1 + fabs(u.x) + fabs(u.v);
+			if (d / scale > st.correction)
+				st.correction = d / scale;
+			G[i] = g;
+			U[i + 1] = u;
+		}
+		if (st.correction <= tol)
+			break;
+	}
+	if (stats)
+		*stats = st;
+	// Точный результат последнего отрезка: им продолжается траектория в res/res_v
+	// (поправленное U[P] отличается от него на величину не больше tol)
+	return F[P - 1];
+}
@@ -0,0 +1,101 @@
+﻿#include <mutex>
+#include <thread>
+#include <atomic>
+#include "rk_async.h"
+
+struct rk_job::impl {
+	std::thread worker;
+	mutable std::mutex m;
+	std::atomic<bool> stop;
+	bool finished;
+	rk_state s;
+	size_t total, made;
+	std::vector<double> t, x, v;
+
+	impl() : stop(false), finished(true), total(0), made(0) {}
+
+	void run(rk_state cur, double end, size_t chunk) {
+		std::vector<double> res, res_v;
+		size_t last = R_K_steps(cur.begin, end, cur.h);
+		// Куски режутся по номерам шагов, так что результат не зависит от chunk
+		while (!stop.load(std::memory_order_relaxed) && cur.steps < last) {
+			size_t from = cur.steps;
+			res.clear();
+			res_v.clear();
+			R_K_advance(cur, last - from < chunk ? last - from : chunk, res, res_v);
+
+			std::lock_guard<std::mutex> lock(m);
+			for (size_t k = 0; k < res.size(); ++k)
+				t.push_back(R_K_t(cur.begin, cur.h, from + k));
+			x.insert(x.end(), res.begin(), res.end());
+			v.insert(v.end(), res_v.begin(), res_v.end());
+			made += res.size();
+			s = cur;
+		}
+		std::lock_guard<std::mutex> lock(m);
+		finished = true;
+	}
+};
+
+rk_job::rk_job() : p(new impl) {}
+
+rk_job::~rk_job() {
+	cancel();
+	wait();
+	delete p;
+}
+
+void rk_job::start(const rk_state& s, double end, size_t chunk) {
+	cancel();
+	wait();
+	p->stop = false;
+	p->finished = false;
+	p->s = s;
+	size_t last = R_K_steps(s.begin, end, s.h);
+	p->total = last > s.steps ? last - s.steps : 0;
+	p->made = 0;
+	p->t.clear();
+	p->x.clear();
+	p->v.clear();
+	p->worker = std::thread(&impl::run, p, s, end, chunk ? chunk : 1);
+}
+
+size_t rk_job::take(std::vector<double>& t, std::vector<double>& x, std::vector<double>& v) {
+	std::lock_guard<std::mutex> lock(p->m);
+	size_t n = p->x.size();
+	t.insert(t.end(), p->t.begin(), p->t.end());
+	x.insert(x.end(), p->x.begin(), p->x.end());
+	v.insert(v.end(), p->v.begin(), p->v.end());
+	p->t.clear();
+	p->x.clear();
+	p->v.clear();
+	return n;
+}
+
+double rk_job::progress() const {
+	std::lock_guard<std::mutex> lock(p->m);
+	return p->total ? double(p->made) / p->total : 1.;
+}
+
+bool rk_job::done() const {
+	std::lock_guard<std::mutex> lock(p->m);
+	return p->finished;
+}
+
+bool rk_job::cancelled() const {
+	return p->stop.load();
+}
+
+void rk_job::cancel() {
+	p->stop = true;
+}
+
+void rk_job::wait() {
+	if (p->worker.joinable())
+		p->worker.join();
+}
+
+rk_state rk_job::state() const {
+	std::lock_guard<std::mutex> lock(p->m);
+	return p->s;
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+
+// Фоновый расчёт R_K: поток считает траекторию кусками по chunk шагов и публикует
+// каждый кусок, вызывающий забирает готовые точки через take() (например, по таймеру формы).
+// Отмена кооперативная - поток проверяет флаг между кусками.
+// Потоки спрятаны в rk_async.cpp (собирается без /clr), поэтому заголовок можно
+// включать и в управляемый код формы.
+class rk_job
+{
+public:
+	rk_job();
+	// Отменяет расчёт и ждёт поток
+	~rk_job();
+
+	// Запускает расчёт от состояния s до end. Точки те же, что дал бы R_K_extend(s, end, ...).
+	// Предыдущий расчёт этого объекта отменяется.
+	void start(const rk_state& s, double end, size_t chunk = 1 << 14);
+
+	// Дописывает в t, x, v все опубликованные и ещё не забранные точки; возвращает их число
+	size_t take(std::vector<double>& t, std::vector<double>& x, std::vector<double>& v);
+
+	// Доля сделанных шагов, от 0 до 1
+	double progress() const;
+	// Поток закончил: дошёл до end или был отменён
+	bool done() const;
+	bool cancelled() const;
+	void cancel();
+	void wait();
+
+	// Состояние после последнего опубликованного куска - с него расчёт можно продолжить
+	rk_state state() const;
+
+private:
+	rk_job(const rk_job&);
+	rk_job& operator=(const rk_job&);
+
+	struct impl;
+	impl* p;
+};
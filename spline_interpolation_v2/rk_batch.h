@@ -0,0 +1,245 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "frk_vm.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Пакет независимых траекторий уравнения x''+λx'cos(Nx)+sin x=0 в виде структуры массивов:
+// i-я траектория - это x[i], v[i], lambda[i], N[i]. Все траектории продвигаются одним шагом h.
+struct rk_batch {
+	std::vector<double> x, v, lambda, N;
+
+	void add(double x0, double x0dash, double _lambda, double _N) {
+		x.push_back(x0);
+		v.push_back(x0dash);
+		lambda.push_back(_lambda);
+		N.push_back(_N);
+	}
+	size_t size() const { return x.size(); }
+	void clear() { x.clear(); v.clear(); lambda.clear(); N.clear(); }
+};
+
+// sin(x + shift*pi/2): приведение к |r| <= pi/4 по трём частям pi/2 (Cody-Waite)
+// и многочлены cephes. Эта же схема повторена в векторных ядрах ниже теми же операциями
+// в том же порядке (без FMA), поэтому траектория совпадает бит в бит, в какую бы дорожку
+// и на каком наборе инструкций она ни попала.
+// Четверть периода - младшие биты мантиссы q + 1.5 * 2^52 (при |q| < 2^51 это q mod 4),
+// а не 32-битное целое, которое у векторных преобразований переполняется уже при |q| > 2^31.
+// Приведение точно примерно до |x| < 1e9; дальше результат неточен, но одинаков во всех путях.
+static const double rk_round_magic = 6755399441055744.0;
+static const double rk_2_pi = 0.63661977236758134308;
+static const double rk_pio2_1 = 1.57079625129699707031E0;
+static const double rk_pio2_2 = 7.54978941586159635335E-8;
+static const double rk_pio2_3 = 5.39030285815811905290E-15;
+static const double rk_sin_c[6] = { 1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+	-1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1 };
+static const double rk_cos_c[6] = { -1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+	2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2 };
+
+inline double rk_sin_q(double x, int shift) {
+	double q = std::nearbyint(x * rk_2_pi);
+	double r = ((x - q * rk_pio2_1) - q * rk_pio2_2) - q * rk_pio2_3;
+	double qm = q + rk_round_magic;
+	uint64_t bits;
+	memcpy(&bits, &qm, sizeof(bits));
+	uint64_t j = bits + (uint64_t)shift;
+	double z = r * r;
+	double s = rk_sin_c[0];
+	double c = rk_cos_c[0];
+	for (int k = 1; k < 6; ++k) {
+		s = s * z + rk_sin_c[k];
+		c = c * z + rk_cos_c[k];
+	}
+	s = r + r * z * s;
+	c = 1. - 0.5 * z + z * z * c;
+	double y = (j & 1) ? c : s;
+	return (j & 2) ? -y : y;
+}
+
+inline double rk_batch_func(double v, double x, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_rhs, 1);
+	return -1 * (lambda * v * rk_sin_q(N * x, 1) + rk_sin_q(x, 0));
+}
+
+// Скалярный шаг RK4 для одной дорожки пакета - формулы те же, что в R_K
+inline void rk_batch_step1(double& _dx, double& _dv, double h, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	double dx1 = h * _dv;
+	double dv1 = h * rk_batch_func(_dv, _dx, lambda, N);
+	double dx2 = h * (_dv + dv1 / 2);
+	double dv2 = h * rk_batch_func(_dv + dv1 / 2, _dx + dx1 / 2, lambda, N);
+	double dx3 = h * (_dv + dv2 / 2);
+	double dv3 = h * rk_batch_func(_dv + dv2 / 2, _dx + dx2 / 2, lambda, N);
+	double dx4 = h * (_dv + dv3);
+	double dv4 = h * rk_batch_func(_dv + dv3, _dx + dx3, lambda, N);
+	_dx += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+	_dv += (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
+}
+
+#if defined(__AVX2__)
+inline __m256d rk_sin_q_avx2(__m256d x, int shift) {
+	__m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(rk_2_pi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(q, _mm256_set1_pd(rk_pio2_1)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(rk_pio2_2)));
+	r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(rk_pio2_3)));
+	__m256i j = _mm256_add_epi64(_mm256_castpd_si256(_mm256_add_pd(q, _mm256_set1_pd(rk_round_magic))), _mm256_set1_epi64x(shift));
+	__m256d z = _mm256_mul_pd(r, r);
+	__m256d s = _mm256_set1_pd(rk_sin_c[0]);
+	__m256d c = _mm256_set1_pd(rk_cos_c[0]);
+	for (int k = 1; k < 6; ++k) {
+		s = _mm256_add_pd(_mm256_mul_pd(s, z), _mm256_set1_pd(rk_sin_c[k]));
+		c = _mm256_add_pd(_mm256_mul_pd(c, z), _mm256_set1_pd(rk_cos_c[k]));
+	}
+	s = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, z), s));
+	c = _mm256_add_pd(_mm256_sub_pd(_mm256_set1_pd(1.), _mm256_mul_pd(_mm256_set1_pd(0.5), z)), _mm256_mul_pd(_mm256_mul_pd(z, z), c));
+	__m256i one = _mm256_set1_epi64x(1);
+	__m256d swap = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(j, one), one));
+	__m256d sign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(j, _mm256_set1_epi64x(2)), 62));
+	return _mm256_xor_pd(_mm256_blendv_pd(s, c, swap), sign);
+}
+
+inline __m256d rk_func_avx2(__m256d v, __m256d x, __m256d lambda, __m256d N) {
+	__m256d t = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(lambda, v), rk_sin_q_avx2(_mm256_mul_pd(N, x), 1)), rk_sin_q_avx2(x, 0));
+	return _mm256_mul_pd(_mm256_set1_pd(-1.), t);
+}
+
+// 4 траектории [j, j+4) держатся в регистрах все steps шагов
+inline void rk_batch_run_avx2(rk_batch& b, size_t j, size_t steps, double _h, double* res, double* res_v) {
+	const size_t n = b.size();
+	__m256d _dx = _mm256_loadu_pd(&b.x[j]), _dv = _mm256_loadu_pd(&b.v[j]);
+	__m256d lambda = _mm256_loadu_pd(&b.lambda[j]), N = _mm256_loadu_pd(&b.N[j]);
+	__m256d h = _mm256_set1_pd(_h), half = _mm256_set1_pd(0.5), two = _mm256_set1_pd(2.), sixth = _mm256_set1_pd(6.);
+	for (size_t k = 0; k < steps; ++k) {
+		if (res) {
+			_mm256_storeu_pd(res + k * n + j, _dx);
+			_mm256_storeu_pd(res_v + k * n + j, _dv);
+		}
+		__m256d dx1 = _mm256_mul_pd(h, _dv);
+		__m256d dv1 = _mm256_mul_pd(h, rk_func_avx2(_dv, _dx, lambda, N));
+		__m256d dx2 = _mm256_mul_pd(h, _mm256_add_pd(_dv, _mm256_mul_pd(dv1, half)));
+		__m256d dv2 = _mm256_mul_pd(h, rk_func_avx2(_mm256_add_pd(_dv, _mm256_mul_pd(dv1, half)), _mm256_add_pd(_dx, _mm256_mul_pd(dx1, half)), lambda, N));
+		__m256d dx3 = _mm256_mul_pd(h, _mm256_add_pd(_dv, _mm256_mul_pd(dv2, half)));
+		__m256d dv3 = _mm256_mul_pd(h, rk_func_avx2(_mm256_add_pd(_dv, _mm256_mul_pd(dv2, half)), _mm256_add_pd(_dx, _mm256_mul_pd(dx2, half)), lambda, N));
+		__m256d dx4 = _mm256_mul_pd(h, _mm256_add_pd(_dv, dv3));
+		__m256d dv4 = _mm256_mul_pd(h, rk_func_avx2(_mm256_add_pd(_dv, dv3), _mm256_add_pd(_dx, dx3), lambda, N));
+		_dx = _mm256_add_pd(_dx, _mm256_div_pd(_mm256_add_pd(_mm256_add_pd(_mm256_add_pd(dx1, _mm256_mul_pd(two, dx2)), _mm256_mul_pd(two, dx3)), dx4), sixth));
+		_dv = _mm256_add_pd(_dv, _mm256_div_pd(_mm256_add_pd(_mm256_add_pd(_mm256_add_pd(dv1, _mm256_mul_pd(two, dv2)), _mm256_mul_pd(two, dv3)), dv4), sixth));
+	}
+	_mm256_storeu_pd(&b.x[j], _dx);
+	_mm256_storeu_pd(&b.v[j], _dv);
+}
+#endif
+
+#if defined(__AVX512F__)
+inline __m512d rk_sin_q_avx512(__m512d x, int shift) {
+	__m512d q = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(rk_2_pi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_sub_pd(x, _mm512_mul_pd(q, _mm512_set1_pd(rk_pio2_1)));
+	r = _mm512_sub_pd(r, _mm512_mul_pd(q, _mm512_set1_pd(rk_pio2_2)));
+	r = _mm512_sub_pd(r, _mm512_mul_pd(q, _mm512_set1_pd(rk_pio2_3)));
+	__m512i j = _mm512_add_epi64(_mm512_castpd_si512(_mm512_add_pd(q, _mm512_set1_pd(rk_round_magic))), _mm512_set1_epi64(shift));
+	__m512d z = _mm512_mul_pd(r, r);
+	__m512d s = _mm512_set1_pd(rk_sin_c[0]);
+	__m512d c = _mm512_set1_pd(rk_cos_c[0]);
+	for (int k = 1; k < 6; ++k) {
+		s = _mm512_add_pd(_mm512_mul_pd(s, z), _mm512_set1_pd(rk_sin_c[k]));
+		c = _mm512_add_pd(_mm512_mul_pd(c, z), _mm512_set1_pd(rk_cos_c[k]));
+	}
+	s = _mm512_add_pd(r, _mm512_mul_pd(_mm512_mul_pd(r, z), s));
+	c = _mm512_add_pd(_mm512_sub_pd(_mm512_set1_pd(1.), _mm512_mul_pd(_mm512_set1_pd(0.5), z)), _mm512_mul_pd(_mm512_mul_pd(z, z), c));
+	__mmask8 swap = _mm512_test_epi64_mask(j, _mm512_set1_epi64(1));
+	__m512i sign = _mm512_slli_epi64(_mm512_and_si512(j, _mm512_set1_epi64(2)), 62);
+	__m512d y = _mm512_mask_blend_pd(swap, s, c);
+	return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(y), sign));
+}
+
+inline __m512d rk_func_avx512(__m512d v, __m512d x, __m512d lambda, __m512d N) {
+	__m512d t = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(lambda, v), rk_sin_q_avx512(_mm512_mul_pd(N, x), 1)), rk_sin_q_avx512(x, 0));
+	return _mm512_mul_pd(_mm512_set1_pd(-1.), t);
+}
+
+// G * 8 траекторий [j, j + 8G) держатся в регистрах все steps шагов. Без FMA цепочка
+// зависимостей шага длиннее, и G = 2 независимые группы в одном цикле её перекрывают
+template <int G>
+inline void rk_batch_run_avx512(rk_batch& b, size_t j, size_t steps, double _h, double* res, double* res_v) {
+	const size_t n = b.size();
+	__m512d _dx[G], _dv[G], lambda[G], N[G];
+	for (int g = 0; g < G; ++g) {
+		_dx[g] = _mm512_loadu_pd(&b.x[j + 8 * g]);
+		_dv[g] = _mm512_loadu_pd(&b.v[j + 8 * g]);
+		lambda[g] = _mm512_loadu_pd(&b.lambda[j + 8 * g]);
+		N[g] = _mm512_loadu_pd(&b.N[j + 8 * g]);
+	}
+	__m512d h = _mm512_set1_pd(_h), half = _mm512_set1_pd(0.5), two = _mm512_set1_pd(2.), sixth = _mm512_set1_pd(6.);
+	for (size_t k = 0; k < steps; ++k) {
+		for (int g = 0; g < G; ++g) {
+			if (res) {
+				_mm512_storeu_pd(res + k * n + j + 8 * g, _dx[g]);
+				_mm512_storeu_pd(res_v + k * n + j + 8 * g, _dv[g]);
+			}
+			__m512d dx1 = _mm512_mul_pd(h, _dv[g]);
+			__m512d dv1 = _mm512_mul_pd(h, rk_func_avx512(_dv[g], _dx[g], lambda[g], N[g]));
+			__m512d dx2 = _mm512_mul_pd(h, _mm512_add_pd(_dv[g], _mm512_mul_pd(dv1, half)));
+			__m512d dv2 = _mm512_mul_pd(h, rk_func_avx512(_mm512_add_pd(_dv[g], _mm512_mul_pd(dv1, half)), _mm512_add_pd(_dx[g], _mm512_mul_pd(dx1, half)), lambda[g], N[g]));
+			__m512d dx3 = _mm512_mul_pd(h, _mm512_add_pd(_dv[g], _mm512_mul_pd(dv2, half)));
+			__m512d dv3 = _mm512_mul_pd(h, rk_func_avx512(_mm512_add_pd(_dv[g], _mm512_mul_pd(dv2, half)), _mm512_add_pd(_dx[g], _mm512_mul_pd(dx2, half)), lambda[g], N[g]));
+			__m512d dx4 = _mm512_mul_pd(h, _mm512_add_pd(_dv[g], dv3));
+			__m512d dv4 = _mm512_mul_pd(h, rk_func_avx512(_mm512_add_pd(_dv[g], dv3), _mm512_add_pd(_dx[g], dx3), lambda[g], N[g]));
+			_dx[g] = _mm512_add_pd(_dx[g], _mm512_div_pd(_mm512_add_pd(_mm512_add_pd(_mm512_add_pd(dx1, _mm512_mul_pd(two, dx2)), _mm512_mul_pd(two, dx3)), dx4), sixth));
+			_dv[g] = _mm512_add_pd(_dv[g], _mm512_div_pd(_mm512_add_pd(_mm512_add_pd(_mm512_add_pd(dv1, _mm512_mul_pd(two, dv2)), _mm512_mul_pd(two, dv3)), dv4), sixth));
+		}
+	}
+	for (int g = 0; g < G; ++g) {
+		_mm512_storeu_pd(&b.x[j + 8 * g], _dx[g]);
+		_mm512_storeu_pd(&b.v[j + 8 * g], _dv[g]);
+	}
+}
+#endif
+
+// Продвигает все траектории пакета на steps шагов RK4. Если res/res_v не нулевые, в них
+// пишутся состояния перед каждым шагом по шагам: res[k * b.size() + i] - x i-й траектории
+// на k-м шаге (как res[k] у R_K). Итоговое состояние остаётся в b.x/b.v.
+inline void R_K_batch_run(rk_batch& b, size_t steps, double h, double* res, double* res_v) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	const size_t n = b.size();
+	size_t j = 0;
+#if defined(__AVX512F__)
+	for (; j + 16 <= n; j += 16)
+		rk_batch_run_avx512<2>(b, j, steps, h, res, res_v);
+	for (; j + 8 <= n; j += 8)
+		rk_batch_run_avx512<1>(b, j, steps, h, res, res_v);
+#endif
+#if defined(__AVX2__)
+	for (; j + 4 <= n; j += 4)
+		rk_batch_run_avx2(b, j, steps, h, res, res_v);
+#endif
+	// Дорожки [0, j) посчитаны в регистрах, их шаги и правые части - разом
+	RK_TRACE_ADD(rk_count_steps, j * steps);
+	RK_TRACE_ADD(rk_count_rhs, 4 * j * steps);
+	for (; j < n; ++j) {
+		double _dx = b.x[j], _dv = b.v[j];
+		for (size_t k = 0; k < steps; ++k) {
+			if (res) {
+				res[k * n + j] = _dx;
+				res_v[k * n + j] = _dv;
+			}
+			rk_batch_step1(_dx, _dv, h, b.lambda[j], b.N[j]);
+		}
+		b.x[j] = _dx;
+		b.v[j] = _dv;
+	}
+}
+
+// Аналог R_K для пакета: та же сетка begin, begin + h, ... < end, результат - по шагам
+// (см. R_K_batch_run). Возвращает число шагов.
+inline size_t R_K_batch(double begin, double end, double h, rk_batch& b, std::vector<double>& res, std::vector<double>& res_v) {
+	size_t steps = R_K_steps(begin, end, h);
+	res.resize(steps * b.size());
+	res_v.resize(steps * b.size());
+	R_K_batch_run(b, steps, h, res.data(), res_v.data());
+	return steps;
+}
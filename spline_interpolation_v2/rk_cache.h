@@ -0,0 +1,207 @@
+﻿#pragma once
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include "frk_vm.h"
+#include "traj_io.h"
+
+// Параметры траектории R_K без end: траектории с одинаковым ключом отличаются только длиной,
+// и более длинная содержит более короткую как начало (R_K_extend продолжает счёт бит в бит)
+struct rk_key {
+	double begin, h, lambda, x0dash, N;
+
+	bool operator==(const rk_key& o) const {
+		return memcmp(this, &o, sizeof(rk_key)) == 0;
+	}
+};
+
+// Адрес по содержимому: FNV-1a от байтов ключа
+inline uint64_t rk_key_hash(const rk_key& k) {
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(&k);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < sizeof(k); ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Кэш траекторий R_K: в памяти - LRU с ограничением по байтам, по желанию - копия на диске
+// в файлах .rktr (traj_io.h), которые читаются traj_read прямо в векторы записи.
+// Запрос до end обслуживается любой сохранённой траекторией того же ключа: если она длиннее,
+// отдаётся её начало, если короче - всё, что есть, и состояние, с которого досчитывать.
+class rk_cache
+{
+public:
+	explicit rk_cache(size_t _budget = (size_t)256 << 20) : budget(_budget), used(0), hits(0), misses(0) {}
+
+	// Каталог для файлов кэша (должен существовать); пустая строка - только память
+	void set_dir(const std::string& _dir) { dir = _dir; }
+
+	// Траектория ключа k на [begin, end): в res/res_v - сколько есть в кэше, но не больше
+	// R_K_steps(begin, end, h) точек; s - состояние после них. Если s.t < end, остаток
+	// досчитывается R_K_extend(s, end, res, res_v). Возвращает число отданных точек.
+	size_t lookup(const rk_key& k, double end, std::vector<double>& res, std::vector<double>& res_v, rk_state& s) {
+		s = R_K_start(k.begin, k.h, k.lambda, k.x0dash, k.N);
+		res.clear();
+		res_v.clear();
+		entry* e = find(k);
+		if (!e) {
+			++misses;
+			return 0;
+		}
+		++hits;
+		size_t want = R_K_steps(k.begin, end, k.h);
+		size_t n = want < e->x.size() ? want : e->x.size();
+		res.assign(e->x.begin(), e->x.begin() + n);
+		res_v.assign(e->v.begin(), e->v.begin() + n);
+		if (n == e->x.size())
+			s = e->last;
+		else {
+			s.t = R_K_t(k.begin, k.h, n);
+			s.x = e->x[n];
+			s.v = e->v[n];
+			s.steps = n;
+		}
+		return n;
+	}
+
+	// Траектория от begin: res/res_v - s.steps точек, s - состояние после них.
+	// Заменяет сохранённую траекторию того же ключа, только если новая длиннее.
+	void store(const rk_state& s, const std::vector<double>& res, const std::vector<double>& res_v) {
+		if (res.size() != s.steps || res_v.size() != s.steps || !s.steps)
+			return;
+		rk_key k = { s.begin, s.h, s.lambda, s.x0dash, s.N };
+		entry* e = find(k);
+		if (e && e->x.size() >= s.steps)
+			return;
+		if (!e)
+			e = insert(k);
+		used -= bytes(*e);
+		e->x = res;
+		e->v = res_v;
+		e->last = s;
+		used += bytes(*e);
+		if (!dir.empty())
+			write(*e);
+		evict();
+	}
+
+	// Досчитывает недостающее и сохраняет результат: то же, что R_K_extend от начала до end
+	void get(const rk_key& k, double end, std::vector<double>& res, std::vector<double>& res_v) {
+		rk_state s;
+		lookup(k, end, res, res_v, s);
+		if (s.t < end) {
+			R_K_extend(s, end, res, res_v);
+			store(s, res, res_v);
+		}
+	}
+
+	void clear() {
+		lru.clear();
+		index.clear();
+		used = 0;
+	}
+
+	size_t bytes() const { return used; }
+	size_t entries() const { return lru.size(); }
+	size_t hit_count() const { return hits; }
+	size_t miss_count() const { return misses; }
+
+private:
+	struct entry {
+		rk_key key;
+		std::vector<double> x, v;
+		rk_state last;
+	};
+
+	static size_t bytes(const entry& e) {
+		return sizeof(entry) + (e.x.capacity() + e.v.capacity()) * sizeof(double);
+	}
+
+	entry* find(const rk_key& k) {
+		std::unordered_map<uint64_t, std::list<entry>::iterator>::iterator it = index.find(rk_key_hash(k));
+		if (it != index.end() && it->second->key == k) {
+			lru.splice(lru.begin(), lru, it->second);
+			return &lru.front();
+		}
+		if (dir.empty())
+			return NULL;
+		return read(k);
+	}
+
+	entry* insert(const rk_key& k) {
+		uint64_t hash = rk_key_hash(k);
+		std::unordered_map<uint64_t, std::list<entry>::iterator>::iterator it = index.find(hash);
+		if (it != index.end()) {
+			// Коллизия хэша - старая запись уступает место
+			used -= bytes(*it->second);
+			lru.erase(it->second);
+		}
+		lru.push_front(entry());
+		lru.front().key = k;
+		index[hash] = lru.begin();
+		used += bytes(lru.front());
+		return &lru.front();
+	}
+
+	// Самые давние записи выбрасываются, пока не уложимся в бюджет; последняя остаётся всегда
+	void evict() {
+		while (used > budget && lru.size() > 1) {
+			used -= bytes(lru.back());
+			index.erase(rk_key_hash(lru.back().key));
+			lru.pop_back();
+		}
+	}
+
+	std::string path(const rk_key& k) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.rktr", (unsigned long long)rk_key_hash(k));
+		return dir + "/" + name;
+	}
+
+	void write(const entry& e) {
+		traj_writer w;
+		if (!w.open(path(e.key).c_str(), traj_make_header(e.key.begin, e.key.h, e.key.lambda, e.key.x0dash, e.key.N), 1 << 16, false))
+			return;
+		for (size_t i = 0; i < e.x.size(); ++i)
+			w.push(R_K_t(e.key.begin, e.key.h, i), e.x[i], e.v[i]);
+		w.close();
+	}
+
+	entry* read(const rk_key& k) {
+		traj_header hd;
+		std::vector<double> x, v;
+		if (!traj_read(path(k).c_str(), hd, NULL, &x, &v))
+			return NULL;
+		rk_key fk = { hd.begin, hd.h, hd.lambda, hd.x0dash, hd.N };
+		if (!(fk == k) || x.empty())
+			return NULL;
+		// Состояние после последней точки - ещё один шаг R_K от неё
+		rk_state s = R_K_start(k.begin, k.h, k.lambda, k.x0dash, k.N);
+		s.t = R_K_t(k.begin, k.h, x.size());
+		s.x = x.back();
+		s.v = v.back();
+		R_K_step(s.x, s.v, s.h, s.lambda, s.N);
+		s.steps = x.size();
+
+		entry* e = insert(k);
+		used -= bytes(*e);
+		e->x.swap(x);
+		e->v.swap(v);
+		e->last = s;
+		used += bytes(*e);
+		evict();
+		return &lru.front();
+	}
+
+	size_t budget, used;
+	size_t hits, misses;
+	std::string dir;
+	std::list<entry> lru;
+	std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+};
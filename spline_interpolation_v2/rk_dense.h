@@ -0,0 +1,134 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+
+// Кубический Эрмит на шаге [t0, t0 + h]: s - доля шага, a0/a1 - ускорения на концах
+inline void rk_hermite(double s, double h, double x0, double v0, double a0, double x1, double v1, double a1, double& x, double& v) {
+	double s2 = s * s, s3 = s2 * s;
+	double h00 = 2 * s3 - 3 * s2 + 1, h10 = s3 - 2 * s2 + s, h01 = -2 * s3 + 3 * s2, h11 = s3 - s2;
+	x = h00 * x0 + h10 * h * v0 + h01 * x1 + h11 * h * v1;
+	v = h00 * v0 + h10 * h * a0 + h01 * v1 + h11 * h * a1;
+}
+
+// Плотный вывод по точкам R_K: x(t) и v(t) в любой момент между узлами t_k = begin + k h.
+// На каждом шаге x - кубический Эрмит по x и v на концах, v - по v и ускорению func,
+// так что известные производные используются и никакой системы решать не нужно
+// (в отличие от cubic_spline::build_spline по одному res). Запрос - O(1): номер шага
+// берётся из (t - begin) / h. Погрешность x - O(h^4), как у самого RK4.
+class rk_dense
+{
+public:
+	rk_dense() : begin(0), h(1), lambda(0), N(0) {}
+
+	// Точки траектории R_K (res/res_v) с теми же begin, h, lambda, N
+	void assign(double _begin, double _h, double _lambda, double _N, const std::vector<double>& res, const std::vector<double>& res_v) {
+		begin = _begin;
+		h = _h;
+		lambda = _lambda;
+		N = _N;
+		nodes.clear();
+		nodes.reserve(res.size() + 1);
+		for (size_t k = 0; k < res.size() && k < res_v.size(); ++k)
+			push(res[k], res_v[k]);
+	}
+
+	// Следующий узел сетки (например, состояние после последнего шага, которое возвращает R_K)
+	void push(double x, double v) {
+		node n = { x, v, func(v, x, lambda, N) };
+		nodes.push_back(n);
+	}
+
+	size_t size() const { return nodes.size(); }
+	bool empty() const { return nodes.empty(); }
+	double t_begin() const { return begin; }
+	double t_end() const { return nodes.empty() ? begin : R_K_t(begin, h, nodes.size() - 1); }
+
+	// Состояние в момент t; вне [t_begin(), t_end()] - состояние на ближайшем конце
+	void at(double t, double& x, double& v) const {
+		if (nodes.size() < 2) {
+			x = nodes.empty() ? 0 : nodes[0].x;
+			v = nodes.empty() ? 0 : nodes[0].v;
+			return;
+		}
+		double u = (t - begin) / h;
+		size_t last = nodes.size() - 2;
+		size_t k;
+		double s;
+		if (!(u > 0)) {
+			k = 0;
+			s = 0;
+		}
+		else if (u >= last + 1) {
+			k = last;
+			s = 1;
+		}
+		else {
+			// Деление может ошибиться на единицу около узла, поэтому шаг сверяется с самими узлами:
+			// в узле s = 0 и возвращается ровно точка R_K
+			k = (size_t)u;
+			if (k > last)
+				k = last;
+			if (k < last && t >= R_K_t(begin, h, k + 1))
+				++k;
+			else if (k > 0 && t < R_K_t(begin, h, k))
+				--k;
+			s = (t - R_K_t(begin, h, k)) / h;
+		}
+		const node& a = nodes[k];
+		const node& b = nodes[k + 1];
+		rk_hermite(s, h, a.x, a.v, a.a, b.x, b.v, b.a, x, v);
+	}
+
+	double x(double t) const {
+		double x, v;
+		at(t, x, v);
+		return x;
+	}
+
+	double v(double t) const {
+		double x, v;
+		at(t, x, v);
+		return v;
+	}
+
+	// Пакетный запрос: m моментов t; xs или vs может быть NULL
+	void eval(const double* t, size_t m, double* xs, double* vs) const {
+		for (size_t i = 0; i < m; ++i) {
+			double x, v;
+			at(t[i], x, v);
+			if (xs)
+				xs[i] = x;
+			if (vs)
+				vs[i] = v;
+		}
+	}
+
+	// Передискретизация с шагом dt: m точек в моменты t0 + i dt
+	void resample(double t0, double dt, size_t m, std::vector<double>& xs, std::vector<double>& vs) const {
+		xs.resize(m);
+		vs.resize(m);
+		for (size_t i = 0; i < m; ++i)
+			at(t0 + i * dt, xs[i], vs[i]);
+	}
+
+private:
+	struct node {
+		double x, v, a;
+	};
+
+	double begin, h, lambda, N;
+	std::vector<node> nodes;
+};
+
+// R_K с плотным выводом: все точки R_K и состояние после последнего шага,
+// так что x(t) определена на всём [begin, end]
+inline rk_dense R_K_dense(double begin, double end, double h, double lambda, double x0dash, double N) {
+	std::vector<double> res, res_v;
+	rk_point p = R_K(begin, end, h, lambda, x0dash, N, res, res_v);
+	rk_dense d;
+	d.assign(begin, h, lambda, N, res, res_v);
+	d.push(p.x, p.v);
+	return d;
+}
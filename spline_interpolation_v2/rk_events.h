@@ -0,0 +1,139 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include "frk_vm.h"
+#include "rk_dense.h"
+
+// События при интегрировании R_K: нули функции g(t, x, v) между узлами сетки.
+// Внутри шага, на концах которого g меняет знак, состояние восполняется кубическим
+// полиномом Эрмита (x по x и v, v по v и func), и корень уточняется по нему методом
+// Иллинойс. Траектория не хранится - только состояния в моменты событий.
+enum rk_event_kind {
+	ev_x_2pi,    // x пересекает кратное 2pi: g = sin(x / 2)
+	ev_v_zero,   // v = 0 (точки поворота): g = v
+	ev_section,  // фаза N x проходит phase (mod 2pi), сечение Пуанкаре: g = sin((N x - phase) / 2)
+	ev_custom    // g = func(t, x, v, user)
+};
+
+struct rk_event {
+	rk_event_kind kind;
+	// 0 - любое пересечение, +1 / -1 - только при росте / убывании g
+	// (для ev_x_2pi и ev_section - при росте / убывании x)
+	int direction;
+	bool terminal;   // остановить интегрирование на этом событии
+	double phase;    // для ev_section
+	double (*func)(double t, double x, double v, void* user);
+	void* user;
+};
+
+inline rk_event rk_make_event(rk_event_kind kind, int direction = 0, bool terminal = false, double phase = 0) {
+	rk_event e = { kind, direction, terminal, phase, NULL, NULL };
+	return e;
+}
+
+struct rk_event_hit {
+	size_t event;  // номер события в переданном массиве
+	double t, x, v;
+};
+
+inline double rk_event_value(const rk_event& e, double t, double x, double v, double N) {
+	switch (e.kind) {
+	case ev_x_2pi:
+		return sin(x / 2);
+	case ev_v_zero:
+		return v;
+	case ev_section:
+		return sin((N * x - e.phase) / 2);
+	default:
+		return e.func(t, x, v, e.user);
+	}
+}
+
+// R_K с событиями: тот же шаг и то же число шагов, что у R_K, в hits дописываются события
+// в порядке времени. Если сработало терминальное событие, интегрирование останавливается
+// и возвращается состояние в момент события (оно же - последний элемент hits),
+// иначе - состояние после последнего шага. t_stop (если не NULL) - время возвращённого состояния.
+inline rk_point R_K_events(double begin, double end, double h, double lambda, double x0dash, double N, const rk_event* events, size_t nevents, std::vector<rk_event_hit>& hits, double* t_stop = NULL) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	double x = begin, v = x0dash, t = begin;
+	size_t steps = R_K_steps(begin, end, h);
+	std::vector<double> g(nevents), g1(nevents);
+	for (size_t e = 0; e < nevents; ++e)
+		g[e] = rk_event_value(events[e], t, x, v, N);
+	std::vector<rk_event_hit> step_hits;
+
+	for (size_t k = 0; k < steps; ++k) {
+		double x0 = x, v0 = v;
+		R_K_step(x, v, h, lambda, N);
+		double t1 = R_K_t(begin, h, k + 1);
+
+		step_hits.clear();
+		double a0 = 0, a1 = 0;
+		bool have_a = false;
+		for (size_t e = 0; e < nevents; ++e) {
+			g1[e] = rk_event_value(events[e], t1, x, v, N);
+			bool rising = g[e] < 0 && g1[e] >= 0, falling = g[e] > 0 && g1[e] <= 0;
+			if (!rising && !falling)
+				continue;
+			if (events[e].kind == ev_x_2pi || events[e].kind == ev_section)
+				rising = v0 + v > 0;
+			if (events[e].direction && (events[e].direction > 0) != rising)
+				continue;
+			if (!have_a) {
+				a0 = func(v0, x0, lambda, N);
+				a1 = func(v, x, lambda, N);
+				have_a = true;
+			}
+			// Иллинойс по доле шага s в [lo, hi]
+			double lo = 0, hi = 1, glo = g[e], ghi = g1[e];
+			double s = 1, xs = x, vs = v;
+			int side = 0;
+			for (int it = 0; it < 100 && hi - lo > 1e-15; ++it) {
+				s = (lo * ghi - hi * glo) / (ghi - glo);
+				if (!(s > lo && s < hi))
+					s = (lo + hi) / 2;
+				rk_hermite(s, h, x0, v0, a0, x, v, a1, xs, vs);
+				double gs = rk_event_value(events[e], t + s * h, xs, vs, N);
+				if (gs == 0)
+					break;
+				if ((gs < 0) == (glo < 0)) {
+					lo = s;
+					glo = gs;
+					if (side == -1)
+						ghi /= 2;
+					side = -1;
+				}
+				else {
+					hi = s;
+					ghi = gs;
+					if (side == 1)
+						glo /= 2;
+					side = 1;
+				}
+			}
+			rk_event_hit hit = { e, t + s * h, xs, vs };
+			step_hits.push_back(hit);
+		}
+		g.swap(g1);
+		t = t1;
+		if (step_hits.empty())
+			continue;
+
+		std::sort(step_hits.begin(), step_hits.end(), [](const rk_event_hit& a, const rk_event_hit& b) { return a.t < b.t; });
+		for (size_t i = 0; i < step_hits.size(); ++i) {
+			hits.push_back(step_hits[i]);
+			if (events[step_hits[i].event].terminal) {
+				if (t_stop)
+					*t_stop = step_hits[i].t;
+				rk_point p = { step_hits[i].x, step_hits[i].v };
+				return p;
+			}
+		}
+	}
+	if (t_stop)
+		*t_stop = t;
+	rk_point p = { x, v };
+	return p;
+}
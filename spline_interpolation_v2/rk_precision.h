@@ -0,0 +1,341 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// R_K в одинарной и смешанной точности.
+//   float - состояние, стадии и хранимая траектория во float: вдвое меньше памяти и
+//           вдвое шире SIMD (пакет rk_batch_f - 8/16 дорожек против 4/8 у rk_batch);
+//   mixed - стадии во float, а приращения _dx/_dv копятся в double: ошибка округления
+//           суммы не растёт с числом шагов, траектория хранится во float.
+// Время везде double: точки сетки - R_K_t(begin, h, k), как у R_K.
+// Чем это оборачивается по точности для данных параметров - rk_precision_compare.
+
+enum rk_precision {
+	rk_prec_double,
+	rk_prec_float,
+	rk_prec_mixed
+};
+
+template <class Real>
+inline Real func_t(Real v, Real x, Real lambda, Real N) {
+	RK_TRACE_ADD(rk_count_rhs, 1);
+	return -1 * (lambda * v * std::cos(N * x) + std::sin(x));
+}
+
+// Шаг RK4 с состоянием типа State и стадиями типа Stage (для double/double - то же, что R_K_step)
+template <class State, class Stage>
+inline void R_K_step_t(State& _dx, State& _dv, Stage h, Stage lambda, Stage N) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	Stage x = (Stage)_dx, v = (Stage)_dv;
+	Stage dx1 = h * v;
+	Stage dv1 = h * func_t<Stage>(v, x, lambda, N);
+	Stage dx2 = h * (v + dv1 / 2);
+	Stage dv2 = h * func_t<Stage>(v + dv1 / 2, x + dx1 / 2, lambda, N);
+	Stage dx3 = h * (v + dv2 / 2);
+	Stage dv3 = h * func_t<Stage>(v + dv2 / 2, x + dx2 / 2, lambda, N);
+	Stage dx4 = h * (v + dv3);
+	Stage dv4 = h * func_t<Stage>(v + dv3, x + dx3, lambda, N);
+	_dx += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+	_dv += (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
+}
+
+// Аналог R_K_into: состояния перед шагами в xs/vs типа Out (NULL - не хранить)
+template <class State, class Stage, class Out>
+inline rk_point R_K_into_t(double begin, double end, double h, double lambda, double x0dash, double N, Out* xs, Out* vs, size_t stride = 1) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	State _dx = (State)begin, _dv = (State)x0dash;
+	Stage sh = (Stage)h, sl = (Stage)lambda, sn = (Stage)N;
+	size_t steps = R_K_steps(begin, end, h);
+	for (size_t k = 0; k < steps; ++k) {
+		if (xs && vs) {
+			xs[k * stride] = (Out)_dx;
+			vs[k * stride] = (Out)_dv;
+		}
+		R_K_step_t<State, Stage>(_dx, _dv, sh, sl, sn);
+	}
+	rk_point p = { (double)_dx, (double)_dv };
+	return p;
+}
+
+// Те же сетка и API, что у R_K, траектория во float
+inline rk_point R_K_float(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<float>& res, std::vector<float>& res_v) {
+	size_t steps = R_K_steps(begin, end, h);
+	size_t base = res.size(), base_v = res_v.size();
+	res.resize(base + steps);
+	res_v.resize(base_v + steps);
+	return R_K_into_t<float, float, float>(begin, end, h, lambda, x0dash, N, res.data() + base, res_v.data() + base_v);
+}
+
+inline rk_point R_K_mixed(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<float>& res, std::vector<float>& res_v) {
+	size_t steps = R_K_steps(begin, end, h);
+	size_t base = res.size(), base_v = res_v.size();
+	res.resize(base + steps);
+	res_v.resize(base_v + steps);
+	return R_K_into_t<double, float, float>(begin, end, h, lambda, x0dash, N, res.data() + base, res_v.data() + base_v);
+}
+
+// Только конечное состояние в выбранной точности
+inline rk_point R_K_final_p(double begin, double end, double h, double lambda, double x0dash, double N, rk_precision p) {
+	if (p == rk_prec_float)
+		return R_K_into_t<float, float, float>(begin, end, h, lambda, x0dash, N, NULL, NULL);
+	if (p == rk_prec_mixed)
+		return R_K_into_t<double, float, float>(begin, end, h, lambda, x0dash, N, NULL, NULL);
+	return R_K_final(begin, end, h, lambda, x0dash, N);
+}
+
+// Отличие от R_K в double на той же сетке
+struct rk_precision_report {
+	double max_x, max_v;     // наибольшее по всем точкам |x - x_double|, |v - v_double|
+	double rms_x, rms_v;
+	double final_x, final_v; // в конечном состоянии
+};
+
+inline rk_precision_report rk_precision_compare(double begin, double end, double h, double lambda, double x0dash, double N, rk_precision p) {
+	rk_precision_report r = { 0, 0, 0, 0, 0, 0 };
+	std::vector<double> res, res_v;
+	rk_point ref = R_K(begin, end, h, lambda, x0dash, N, res, res_v);
+	std::vector<float> fx, fv;
+	rk_point q;
+	if (p == rk_prec_float)
+		q = R_K_float(begin, end, h, lambda, x0dash, N, fx, fv);
+	else if (p == rk_prec_mixed)
+		q = R_K_mixed(begin, end, h, lambda, x0dash, N, fx, fv);
+	else
+		return r;
+	for (size_t k = 0; k < res.size(); ++k) {
+		double ex = fabs(fx[k] - res[k]), ev = fabs(fv[k] - res_v[k]);
+		if (ex > r.max_x)
+			r.max_x = ex;
+		if (ev > r.max_v)
+			r.max_v = ev;
+		r.rms_x += ex * ex;
+		r.rms_v += ev * ev;
+	}
+	if (!res.empty()) {
+		r.rms_x = sqrt(r.rms_x / res.size());
+		r.rms_v = sqrt(r.rms_v / res.size());
+	}
+	r.final_x = fabs(q.x - ref.x);
+	r.final_v = fabs(q.v - ref.v);
+	return r;
+}
+
+// Пакет траекторий во float - как rk_batch (rk_batch.h), но дорожек в регистре вдвое больше
+struct rk_batch_f {
+	std::vector<float> x, v, lambda, N;
+
+	void add(float x0, float x0dash, float _lambda, float _N) {
+		x.push_back(x0);
+		v.push_back(x0dash);
+		lambda.push_back(_lambda);
+		N.push_back(_N);
+	}
+	size_t size() const { return x.size(); }
+	void clear() { x.clear(); v.clear(); lambda.clear(); N.clear(); }
+};
+
+// sin(x + shift*pi/2) во float: та же схема, что rk_sin_q, с многочленами cephes sinf
+static const float rk_2_pi_f = 0.636619772f;
+static const float rk_pio2_1f = 1.5703125f;
+static const float rk_pio2_2f = 4.837512969970703125e-4f;
+static const float rk_pio2_3f = 7.54978995489188216e-8f;
+static const float rk_sin_cf[3] = { -1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f };
+static const float rk_cos_cf[3] = { 2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f };
+
+inline float rk_sin_qf(float x, int shift) {
+	float q = std::nearbyint(x * rk_2_pi_f);
+	float r = ((x - q * rk_pio2_1f) - q * rk_pio2_2f) - q * rk_pio2_3f;
+	int j = (int)q + shift;
+	float z = r * r;
+	float s = rk_sin_cf[0];
+	float c = rk_cos_cf[0];
+	for (int k = 1; k < 3; ++k) {
+		s = s * z + rk_sin_cf[k];
+		c = c * z + rk_cos_cf[k];
+	}
+	s = r + r * z * s;
+	c = 1.f - 0.5f * z + z * z * c;
+	float y = (j & 1) ? c : s;
+	return (j & 2) ? -y : y;
+}
+
+inline float rk_batch_func_f(float v, float x, float lambda, float N) {
+	RK_TRACE_ADD(rk_count_rhs, 1);
+	return -1 * (lambda * v * rk_sin_qf(N * x, 1) + rk_sin_qf(x, 0));
+}
+
+inline void rk_batch_f_step1(float& _dx, float& _dv, float h, float lambda, float N) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	float dx1 = h * _dv;
+	float dv1 = h * rk_batch_func_f(_dv, _dx, lambda, N);
+	float dx2 = h * (_dv + dv1 / 2);
+	float dv2 = h * rk_batch_func_f(_dv + dv1 / 2, _dx + dx1 / 2, lambda, N);
+	float dx3 = h * (_dv + dv2 / 2);
+	float dv3 = h * rk_batch_func_f(_dv + dv2 / 2, _dx + dx2 / 2, lambda, N);
+	float dx4 = h * (_dv + dv3);
+	float dv4 = h * rk_batch_func_f(_dv + dv3, _dx + dx3, lambda, N);
+	_dx += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+	_dv += (dv1 + 2 * dv2 + 2 * dv3 + dv4) / 6;
+}
+
+#if defined(__AVX2__)
+inline __m256 rk_sin_q_avx2f(__m256 x, int shift) {
+	__m256 q = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(rk_2_pi_f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_sub_ps(x, _mm256_mul_ps(q, _mm256_set1_ps(rk_pio2_1f)));
+	r = _mm256_sub_ps(r, _mm256_mul_ps(q, _mm256_set1_ps(rk_pio2_2f)));
+	r = _mm256_sub_ps(r, _mm256_mul_ps(q, _mm256_set1_ps(rk_pio2_3f)));
+	__m256i j = _mm256_add_epi32(_mm256_cvtps_epi32(q), _mm256_set1_epi32(shift));
+	__m256 z = _mm256_mul_ps(r, r);
+	__m256 s = _mm256_set1_ps(rk_sin_cf[0]);
+	__m256 c = _mm256_set1_ps(rk_cos_cf[0]);
+	for (int k = 1; k < 3; ++k) {
+		s = _mm256_add_ps(_mm256_mul_ps(s, z), _mm256_set1_ps(rk_sin_cf[k]));
+		c = _mm256_add_ps(_mm256_mul_ps(c, z), _mm256_set1_ps(rk_cos_cf[k]));
+	}
+	s = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, z), s));
+	c = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(_mm256_set1_ps(0.5f), z)), _mm256_mul_ps(_mm256_mul_ps(z, z), c));
+	__m256i one = _mm256_set1_epi32(1);
+	__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, one), one));
+	__m256 sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), 30));
+	return _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sign);
+}
+
+inline __m256 rk_func_avx2f(__m256 v, __m256 x, __m256 lambda, __m256 N) {
+	__m256 t = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(lambda, v), rk_sin_q_avx2f(_mm256_mul_ps(N, x), 1)), rk_sin_q_avx2f(x, 0));
+	return _mm256_sub_ps(_mm256_setzero_ps(), t);
+}
+
+// 8 траекторий [j, j+8) держатся в регистрах все steps шагов
+inline void rk_batch_f_run_avx2(rk_batch_f& b, size_t j, size_t steps, float _h, float* res, float* res_v) {
+	const size_t n = b.size();
+	__m256 _dx = _mm256_loadu_ps(&b.x[j]), _dv = _mm256_loadu_ps(&b.v[j]);
+	__m256 lambda = _mm256_loadu_ps(&b.lambda[j]), N = _mm256_loadu_ps(&b.N[j]);
+	__m256 h = _mm256_set1_ps(_h), half = _mm256_set1_ps(0.5f), two = _mm256_set1_ps(2.f), sixth = _mm256_set1_ps(6.f);
+	for (size_t k = 0; k < steps; ++k) {
+		if (res) {
+			_mm256_storeu_ps(res + k * n + j, _dx);
+			_mm256_storeu_ps(res_v + k * n + j, _dv);
+		}
+		__m256 dx1 = _mm256_mul_ps(h, _dv);
+		__m256 dv1 = _mm256_mul_ps(h, rk_func_avx2f(_dv, _dx, lambda, N));
+		__m256 dx2 = _mm256_mul_ps(h, _mm256_add_ps(_dv, _mm256_mul_ps(dv1, half)));
+		__m256 dv2 = _mm256_mul_ps(h, rk_func_avx2f(_mm256_add_ps(_dv, _mm256_mul_ps(dv1, half)), _mm256_add_ps(_dx, _mm256_mul_ps(dx1, half)), lambda, N));
+		__m256 dx3 = _mm256_mul_ps(h, _mm256_add_ps(_dv, _mm256_mul_ps(dv2, half)));
+		__m256 dv3 = _mm256_mul_ps(h, rk_func_avx2f(_mm256_add_ps(_dv, _mm256_mul_ps(dv2, half)), _mm256_add_ps(_dx, _mm256_mul_ps(dx2, half)), lambda, N));
+		__m256 dx4 = _mm256_mul_ps(h, _mm256_add_ps(_dv, dv3));
+		__m256 dv4 = _mm256_mul_ps(h, rk_func_avx2f(_mm256_add_ps(_dv, dv3), _mm256_add_ps(_dx, dx3), lambda, N));
+		_dx = _mm256_add_ps(_dx, _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(dx1, _mm256_mul_ps(two, dx2)), _mm256_add_ps(_mm256_mul_ps(two, dx3), dx4)), sixth));
+		_dv = _mm256_add_ps(_dv, _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(dv1, _mm256_mul_ps(two, dv2)), _mm256_add_ps(_mm256_mul_ps(two, dv3), dv4)), sixth));
+	}
+	_mm256_storeu_ps(&b.x[j], _dx);
+	_mm256_storeu_ps(&b.v[j], _dv);
+}
+#endif
+
+#if defined(__AVX512F__)
+inline __m512 rk_sin_q_avx512f(__m512 x, int shift) {
+	__m512 q = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(rk_2_pi_f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512 r = _mm512_fnmadd_ps(q, _mm512_set1_ps(rk_pio2_1f), x);
+	r = _mm512_fnmadd_ps(q, _mm512_set1_ps(rk_pio2_2f), r);
+	r = _mm512_fnmadd_ps(q, _mm512_set1_ps(rk_pio2_3f), r);
+	__m512i j = _mm512_add_epi32(_mm512_cvtps_epi32(q), _mm512_set1_epi32(shift));
+	__m512 z = _mm512_mul_ps(r, r);
+	__m512 s = _mm512_set1_ps(rk_sin_cf[0]);
+	__m512 c = _mm512_set1_ps(rk_cos_cf[0]);
+	for (int k = 1; k < 3; ++k) {
+		s = _mm512_fmadd_ps(s, z, _mm512_set1_ps(rk_sin_cf[k]));
+		c = _mm512_fmadd_ps(c, z, _mm512_set1_ps(rk_cos_cf[k]));
+	}
+	s = _mm512_fmadd_ps(_mm512_mul_ps(r, z), s, r);
+	c = _mm512_fmadd_ps(_mm512_mul_ps(z, z), c, _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, _mm512_set1_ps(1.f)));
+	__mmask16 swap = _mm512_test_epi32_mask(j, _mm512_set1_epi32(1));
+	__m512i sign = _mm512_slli_epi32(_mm512_and_si512(j, _mm512_set1_epi32(2)), 30);
+	__m512 y = _mm512_mask_blend_ps(swap, s, c);
+	return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(y), sign));
+}
+
+inline __m512 rk_func_avx512f(__m512 v, __m512 x, __m512 lambda, __m512 N) {
+	__m512 t = _mm512_fmadd_ps(_mm512_mul_ps(lambda, v), rk_sin_q_avx512f(_mm512_mul_ps(N, x), 1), rk_sin_q_avx512f(x, 0));
+	return _mm512_sub_ps(_mm512_setzero_ps(), t);
+}
+
+// 16 траекторий [j, j+16) держатся в регистрах все steps шагов
+inline void rk_batch_f_run_avx512(rk_batch_f& b, size_t j, size_t steps, float _h, float* res, float* res_v) {
+	const size_t n = b.size();
+	__m512 _dx = _mm512_loadu_ps(&b.x[j]), _dv = _mm512_loadu_ps(&b.v[j]);
+	__m512 lambda = _mm512_loadu_ps(&b.lambda[j]), N = _mm512_loadu_ps(&b.N[j]);
+	__m512 h = _mm512_set1_ps(_h), half = _mm512_set1_ps(0.5f), two = _mm512_set1_ps(2.f), sixth = _mm512_set1_ps(6.f);
+	for (size_t k = 0; k < steps; ++k) {
+		if (res) {
+			_mm512_storeu_ps(res + k * n + j, _dx);
+			_mm512_storeu_ps(res_v + k * n + j, _dv);
+		}
+		__m512 dx1 = _mm512_mul_ps(h, _dv);
+		__m512 dv1 = _mm512_mul_ps(h, rk_func_avx512f(_dv, _dx, lambda, N));
+		__m512 dx2 = _mm512_mul_ps(h, _mm512_fmadd_ps(dv1, half, _dv));
+		__m512 dv2 = _mm512_mul_ps(h, rk_func_avx512f(_mm512_fmadd_ps(dv1, half, _dv), _mm512_fmadd_ps(dx1, half, _dx), lambda, N));
+		__m512 dx3 = _mm512_mul_ps(h, _mm512_fmadd_ps(dv2, half, _dv));
+		__m512 dv3 = _mm512_mul_ps(h, rk_func_avx512f(_mm512_fmadd_ps(dv2, half, _dv), _mm512_fmadd_ps(dx2, half, _dx), lambda, N));
+		__m512 dx4 = _mm512_mul_ps(h, _mm512_add_ps(_dv, dv3));
+		__m512 dv4 = _mm512_mul_ps(h, rk_func_avx512f(_mm512_add_ps(_dv, dv3), _mm512_add_ps(_dx, dx3), lambda, N));
+		_dx = _mm512_add_ps(_dx, _mm512_div_ps(_mm512_add_ps(_mm512_fmadd_ps(two, dx2, dx1), _mm512_fmadd_ps(two, dx3, dx4)), sixth));
+		_dv = _mm512_add_ps(_dv, _mm512_div_ps(_mm512_add_ps(_mm512_fmadd_ps(two, dv2, dv1), _mm512_fmadd_ps(two, dv3, dv4)), sixth));
+	}
+	_mm512_storeu_ps(&b.x[j], _dx);
+	_mm512_storeu_ps(&b.v[j], _dv);
+}
+#endif
+
+// Как R_K_batch_run, во float: res[k * b.size() + i] - x i-й траектории на k-м шаге.
+// У затухающих траекторий (большие lambda) x доходит до 1e-18, и r z в rk_sin_qf уходит
+// в денормализованные float, которые считаются в десятки раз медленнее. На время расчёта
+// включается сброс денормалов в ноль (FTZ/DAZ), по выходе прежний режим восстанавливается.
+inline void R_K_batch_f_run(rk_batch_f& b, size_t steps, double h, float* res, float* res_v) {
+	const size_t n = b.size();
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	const float fh = (float)h;
+	size_t j = 0;
+#if defined(__AVX2__) || defined(__AVX512F__)
+	unsigned csr = _mm_getcsr();
+	_mm_setcsr(csr | 0x8040);
+#endif
+#if defined(__AVX512F__)
+	for (; j + 16 <= n; j += 16)
+		rk_batch_f_run_avx512(b, j, steps, fh, res, res_v);
+#endif
+#if defined(__AVX2__)
+	for (; j + 8 <= n; j += 8)
+		rk_batch_f_run_avx2(b, j, steps, fh, res, res_v);
+#endif
+	// Дорожки [0, j) посчитаны в регистрах, их шаги и правые части - разом
+	RK_TRACE_ADD(rk_count_steps, j * steps);
+	RK_TRACE_ADD(rk_count_rhs, 4 * j * steps);
+	for (; j < n; ++j) {
+		float _dx = b.x[j], _dv = b.v[j];
+		for (size_t k = 0; k < steps; ++k) {
+			if (res) {
+				res[k * n + j] = _dx;
+				res_v[k * n + j] = _dv;
+			}
+			rk_batch_f_step1(_dx, _dv, fh, b.lambda[j], b.N[j]);
+		}
+		b.x[j] = _dx;
+		b.v[j] = _dv;
+	}
+#if defined(__AVX2__) || defined(__AVX512F__)
+	_mm_setcsr(csr);
+#endif
+}
+
+inline size_t R_K_batch_f(double begin, double end, double h, rk_batch_f& b, std::vector<float>& res, std::vector<float>& res_v) {
+	size_t steps = R_K_steps(begin, end, h);
+	res.resize(steps * b.size());
+	res_v.resize(steps * b.size());
+	R_K_batch_f_run(b, steps, h, res.data(), res_v.data());
+	return steps;
+}
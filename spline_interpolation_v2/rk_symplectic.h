@@ -0,0 +1,72 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include "frk_vm.h"
+
+// Симплектические (расщепляющие) схемы для x'' = -(lambda x' cos(Nx) + sin x).
+// Уравнение делится на два потока, каждый из которых решается точно:
+//   A (сдвиг): x' = v, v' = 0                          -> x += v t
+//   B (толчок): x' = 0, v' = -(a v + b), a = lambda cos(Nx), b = sin x
+//      -> v = v e^{-a t} + b (e^{-a t} - 1) / a, при a = 0: v - b t
+// Затухание входит в точный толчок, поэтому при lambda = 0 схемы симплектичны
+// (энергия колеблется около начальной без дрейфа), а при малых lambda близки к этому.
+enum rk_symplectic_method {
+	rk_verlet,   // Штёрмер-Верле A(h/2) B(h) A(h/2), 2-й порядок, один толчок на шаг
+	rk_yoshida4  // композиция Иошиды из трёх шагов Верле, 4-й порядок
+};
+
+// Энергия консервативной части (lambda = 0): v^2/2 + 1 - cos x
+inline double rk_energy(double x, double v) {
+	return v * v / 2 + 1 - cos(x);
+}
+
+// Точный толчок B на время t: v -= t phi(-a t) (a v + b), phi(z) = (e^z - 1) / z, phi(0) = 1
+inline void rk_kick(double x, double& v, double t, double lambda, double N) {
+	RK_TRACE_ADD(rk_count_rhs, 1);
+	double a = lambda * cos(N * x), b = sin(x);
+	double z = -a * t;
+	double phi = z == 0 ? 1 : expm1(z) / z;
+	v -= t * phi * (a * v + b);
+}
+
+inline void rk_verlet_step(double& x, double& v, double h, double lambda, double N) {
+	x += v * h / 2;
+	rk_kick(x, v, h, lambda, N);
+	x += v * h / 2;
+}
+
+inline void rk_yoshida4_step(double& x, double& v, double h, double lambda, double N) {
+	const double cbrt2 = 1.2599210498948732;
+	const double w1 = 1 / (2 - cbrt2), w0 = -cbrt2 / (2 - cbrt2);
+	rk_verlet_step(x, v, w1 * h, lambda, N);
+	rk_verlet_step(x, v, w0 * h, lambda, N);
+	rk_verlet_step(x, v, w1 * h, lambda, N);
+}
+
+// Как R_K_into: то же число шагов R_K_steps(begin, end, h), состояние перед k-м шагом
+// в xs[k * stride], vs[k * stride] (NULL - не сохранять), возвращает состояние после последнего шага
+inline rk_point R_K_symplectic_into(double begin, double end, double h, double lambda, double x0dash, double N, rk_symplectic_method method, double* xs, double* vs, size_t stride = 1) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	double x = begin, v = x0dash;
+	size_t steps = R_K_steps(begin, end, h);
+	RK_TRACE_ADD(rk_count_steps, steps);
+	for (size_t k = 0; k < steps; ++k) {
+		if (xs && vs) {
+			xs[k * stride] = x;
+			vs[k * stride] = v;
+		}
+		if (method == rk_yoshida4)
+			rk_yoshida4_step(x, v, h, lambda, N);
+		else
+			rk_verlet_step(x, v, h, lambda, N);
+	}
+	rk_point p = { x, v };
+	return p;
+}
+
+inline rk_point R_K_symplectic(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v, rk_symplectic_method method = rk_yoshida4) {
+	res.resize(R_K_steps(begin, end, h));
+	res_v.resize(res.size());
+	return R_K_symplectic_into(begin, end, h, lambda, x0dash, N, method, res.data(), res_v.data());
+}
@@ -0,0 +1,121 @@
+﻿#pragma once
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "frk_vm.h"
+
+// Явные методы Рунге-Кутты, заданные таблицей Бутчера на этапе компиляции.
+// Таблица - тип с полями stages, a[stages][stages], b[stages], c[stages].
+// Коэффициенты - constexpr, поэтому нулевые a[i][j] и циклы по стадиям и размерности
+// разворачиваются компилятором, а правая часть встраивается: вызовов через указатель нет.
+
+struct tableau_euler {
+	static const int stages = 1;
+	static constexpr double a[1][1] = { { 0 } };
+	static constexpr double b[1] = { 1 };
+	static constexpr double c[1] = { 0 };
+};
+
+// Метод средней точки (2-й порядок)
+struct tableau_midpoint {
+	static const int stages = 2;
+	static constexpr double a[2][2] = { { 0, 0 }, { 0.5, 0 } };
+	static constexpr double b[2] = { 0, 1 };
+	static constexpr double c[2] = { 0, 0.5 };
+};
+
+// Метод Хойна (2-й порядок)
+struct tableau_heun {
+	static const int stages = 2;
+	static constexpr double a[2][2] = { { 0, 0 }, { 1, 0 } };
+	static constexpr double b[2] = { 0.5, 0.5 };
+	static constexpr double c[2] = { 0, 1 };
+};
+
+// Метод Кутты 3-го порядка
+struct tableau_rk3 {
+	static const int stages = 3;
+	static constexpr double a[3][3] = { { 0, 0, 0 }, { 0.5, 0, 0 }, { -1, 2, 0 } };
+	static constexpr double b[3] = { 1. / 6, 2. / 3, 1. / 6 };
+	static constexpr double c[3] = { 0, 0.5, 1 };
+};
+
+// Классический RK4 - тот же метод, что в R_K
+struct tableau_rk4 {
+	static const int stages = 4;
+	static constexpr double a[4][4] = { { 0, 0, 0, 0 }, { 0.5, 0, 0, 0 }, { 0, 0.5, 0, 0 }, { 0, 0, 1, 0 } };
+	static constexpr double b[4] = { 1. / 6, 1. / 3, 1. / 3, 1. / 6 };
+	static constexpr double c[4] = { 0, 0.5, 0.5, 1 };
+};
+
+// Правило 3/8 (4-й порядок)
+struct tableau_rk38 {
+	static const int stages = 4;
+	static constexpr double a[4][4] = { { 0, 0, 0, 0 }, { 1. / 3, 0, 0, 0 }, { -1. / 3, 1, 0, 0 }, { 1, -1, 1, 0 } };
+	static constexpr double b[4] = { 1. / 8, 3. / 8, 3. / 8, 1. / 8 };
+	static constexpr double c[4] = { 0, 1. / 3, 2. / 3, 1 };
+};
+
+// Правая часть уравнения из frk_vm.h: y = (x, v), x' = v, v' = func(v, x).
+// Любая другая правая часть - функтор с тем же operator()(t, y, dydt).
+struct pendulum_rhs {
+	double lambda, N;
+
+	void operator()(double, const std::array<double, 2>& y, std::array<double, 2>& dydt) const {
+		dydt[0] = y[1];
+		dydt[1] = func(y[1], y[0], lambda, N);
+	}
+};
+
+// Один шаг метода Tableau для y' = f(t, y), y - вектор размерности Dim
+template <class Tableau, size_t Dim, class Rhs>
+inline void rk_step(const Rhs& f, double t, std::array<double, Dim>& y, double h) {
+	RK_TRACE_ADD(rk_count_steps, 1);
+	std::array<double, Dim> k[Tableau::stages];
+	for (int s = 0; s < Tableau::stages; ++s) {
+		std::array<double, Dim> ys = y;
+		for (int j = 0; j < s; ++j)
+			if (Tableau::a[s][j] != 0)
+				for (size_t d = 0; d < Dim; ++d)
+					ys[d] += h * Tableau::a[s][j] * k[j][d];
+		f(t + Tableau::c[s] * h, ys, k[s]);
+	}
+	for (int s = 0; s < Tableau::stages; ++s)
+		if (Tableau::b[s] != 0)
+			for (size_t d = 0; d < Dim; ++d)
+				y[d] += h * Tableau::b[s] * k[s][d];
+}
+
+// Интегрирование на [begin, end) с тем же числом шагов, что у R_K (R_K_steps).
+// Состояние перед k-м шагом пишется в out[k], если out != NULL
+// (буфер на R_K_steps(begin, end, h) элементов). Возвращает состояние после последнего шага.
+template <class Tableau, size_t Dim, class Rhs>
+inline std::array<double, Dim> rk_integrate(const Rhs& f, double begin, double end, double h, std::array<double, Dim> y, std::array<double, Dim>* out = NULL) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	size_t steps = R_K_steps(begin, end, h);
+	for (size_t k = 0; k < steps; ++k) {
+		if (out)
+			out[k] = y;
+		rk_step<Tableau>(f, R_K_t(begin, h, k), y, h);
+	}
+	return y;
+}
+
+// То же для уравнения frk_vm.h в формате R_K: траектории x и v дописываются в res, res_v
+template <class Tableau>
+inline rk_point R_K_tableau(double begin, double end, double h, double lambda, double x0dash, double N, std::vector<double>& res, std::vector<double>& res_v) {
+	RK_TRACE_SCOPE(rk_phase_integrate);
+	size_t steps = R_K_steps(begin, end, h);
+	size_t base = res.size(), base_v = res_v.size();
+	res.resize(base + steps);
+	res_v.resize(base_v + steps);
+	pendulum_rhs f = { lambda, N };
+	std::array<double, 2> y = { begin, x0dash };
+	for (size_t k = 0; k < steps; ++k) {
+		res[base + k] = y[0];
+		res_v[base_v + k] = y[1];
+		rk_step<Tableau>(f, R_K_t(begin, h, k), y, h);
+	}
+	rk_point p = { y[0], y[1] };
+	return p;
+}
@@ -0,0 +1,204 @@
+﻿#include "rk_trace.h"
+
+#if defined(VM_RK_TRACE)
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace {
+
+const char* const counter_names[rk_count_total] = { "rhs", "steps", "rejected", "alloc", "spline_eval" };
+const char* const phase_names[rk_phase_total] = { "integrate", "export", "spline_build", "spline_eval", "render" };
+
+// Корзина b - длительности [2^(b-1), 2^b) нс, корзина 0 - ноль
+const int buckets = 64;
+
+struct histogram {
+	std::atomic<uint64_t> count, sum, max;
+	std::atomic<uint64_t> bucket[buckets];
+};
+
+struct event {
+	int phase;
+	unsigned tid;
+	uint64_t start, dur;
+};
+
+// Счётчики - отдельно от trace_data: их трогает и operator new, в том числе
+// во время создания самого trace_data, поэтому им нужна статическая инициализация нулями.
+// func и шаги считаются при каждом вызове из всех потоков, поэтому поток копит их в своих
+// обычных счётчиках и переносит в общие при выходе из замера фазы, при чтении и при завершении
+std::atomic<uint64_t> totals[rk_count_total];
+
+struct local_counters {
+	uint64_t c[rk_count_total];
+	bool hooked;  // перенос при завершении потока уже зарегистрирован
+};
+
+thread_local local_counters local;
+
+void flush_local() {
+	for (int c = 0; c < rk_count_total; ++c)
+		if (local.c[c]) {
+			totals[c].fetch_add(local.c[c], std::memory_order_relaxed);
+			local.c[c] = 0;
+		}
+}
+
+struct thread_flush {
+	~thread_flush() { flush_local(); }
+};
+
+void hook_thread_exit() {
+	local.hooked = true;
+	static thread_local thread_flush f;
+	(void)f;
+}
+
+struct trace_data {
+	histogram phases[rk_phase_total];
+	std::vector<event> events;
+	std::atomic<size_t> used;
+	std::atomic<unsigned> threads;
+	uint64_t origin;
+
+	trace_data() : events((size_t)1 << 18), threads(0) { clear(); }
+
+	void clear() {
+		for (int p = 0; p < rk_phase_total; ++p) {
+			phases[p].count = phases[p].sum = phases[p].max = 0;
+			for (int b = 0; b < buckets; ++b)
+				phases[p].bucket[b] = 0;
+		}
+		used = 0;
+		origin = rk_trace_now();
+	}
+};
+
+trace_data& data() {
+	static trace_data d;
+	return d;
+}
+
+unsigned thread_index() {
+	static thread_local unsigned id = data().threads.fetch_add(1) + 1;
+	return id;
+}
+
+int bucket_of(uint64_t ns) {
+	int b = 0;
+	while (ns) {
+		ns >>= 1;
+		++b;
+	}
+	return b < buckets ? b : buckets - 1;
+}
+
+// Верхняя граница корзины, в которую попадает доля q замеров
+uint64_t quantile(const histogram& h, double q) {
+	uint64_t n = h.count.load(), need = (uint64_t)(q * n), seen = 0;
+	for (int b = 0; b < buckets; ++b) {
+		seen += h.bucket[b].load();
+		if (seen > need)
+			return b ? (uint64_t)1 << b : 0;
+	}
+	return h.max.load();
+}
+
+}
+
+void rk_trace_add(rk_trace_counter c, uint64_t n) {
+	local.c[c] += n;
+	if (!local.hooked)
+		hook_thread_exit();
+}
+
+uint64_t rk_trace_count(rk_trace_counter c) {
+	flush_local();
+	return totals[c].load();
+}
+
+uint64_t rk_trace_now() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void rk_trace_record(rk_trace_phase p, uint64_t start, uint64_t end) {
+	flush_local();
+	trace_data& d = data();
+	uint64_t dur = end > start ? end - start : 0;
+	histogram& h = d.phases[p];
+	h.count.fetch_add(1, std::memory_order_relaxed);
+	h.sum.fetch_add(dur, std::memory_order_relaxed);
+	h.bucket[bucket_of(dur)].fetch_add(1, std::memory_order_relaxed);
+	uint64_t m = h.max.load(std::memory_order_relaxed);
+	while (dur > m && !h.max.compare_exchange_weak(m, dur, std::memory_order_relaxed)) {
+	}
+	// Место в списке занимается атомарно; когда оно кончилось, интервалы идут только в гистограммы
+	size_t i = d.used.fetch_add(1, std::memory_order_relaxed);
+	if (i < d.events.size()) {
+		event e = { p, thread_index(), start, dur };
+		d.events[i] = e;
+	}
+}
+
+// Вызывать, когда замеряемые расчёты не идут
+void rk_trace_reset(size_t max_events) {
+	trace_data& d = data();
+	d.events.assign(max_events, event());
+	d.clear();
+	for (int c = 0; c < rk_count_total; ++c)
+		totals[c] = local.c[c] = 0;
+}
+
+bool rk_trace_write(const char* path) {
+	trace_data& d = data();
+	FILE* f = fopen(path, "w");
+	if (!f)
+		return false;
+	size_t n = d.used.load();
+	if (n > d.events.size())
+		n = d.events.size();
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (size_t i = 0; i < n; ++i) {
+		const event& e = d.events[i];
+		// ts и dur - в микросекундах от rk_trace_reset
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n", phase_names[e.phase], e.tid,
+			(e.start - d.origin) / 1e3, e.dur / 1e3, i + 1 < n ? "," : "");
+	}
+	fprintf(f, "],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"dropped_events\":%llu,\n\"counters\":{",
+		(unsigned long long)(d.used.load() - n));
+	for (int c = 0; c < rk_count_total; ++c)
+		fprintf(f, "%s\"%s\":%llu", c ? "," : "", counter_names[c], (unsigned long long)rk_trace_count((rk_trace_counter)c));
+	fprintf(f, "},\n\"histograms_ns\":{");
+	for (int p = 0; p < rk_phase_total; ++p) {
+		const histogram& h = d.phases[p];
+		fprintf(f, "%s\n\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,\"log2_buckets\":[", p ? "," : "", phase_names[p],
+			(unsigned long long)h.count.load(), (unsigned long long)h.sum.load(), (unsigned long long)h.max.load());
+		int last = 0;
+		for (int b = 0; b < buckets; ++b)
+			if (h.bucket[b].load())
+				last = b + 1;
+		for (int b = 0; b < last; ++b)
+			fprintf(f, "%s%llu", b ? "," : "", (unsigned long long)h.bucket[b].load());
+		fprintf(f, "]}");
+	}
+	fprintf(f, "}}}\n");
+	return fclose(f) == 0;
+}
+
+void rk_trace_report(FILE* out) {
+	trace_data& d = data();
+	for (int c = 0; c < rk_count_total; ++c)
+		fprintf(out, "%-14s %llu\n", counter_names[c], (unsigned long long)rk_trace_count((rk_trace_counter)c));
+	fprintf(out, "%-14s %10s %14s %12s %12s %12s %12s\n", "phase", "count", "total_ns", "mean_ns", "max_ns", "p50_ns<=", "p99_ns<=");
+	for (int p = 0; p < rk_phase_total; ++p) {
+		const histogram& h = d.phases[p];
+		uint64_t n = h.count.load();
+		if (!n)
+			continue;
+		fprintf(out, "%-14s %10llu %14llu %12.0f %12llu %12llu %12llu\n", phase_names[p], (unsigned long long)n, (unsigned long long)h.sum.load(),
+			double(h.sum.load()) / n, (unsigned long long)h.max.load(), (unsigned long long)quantile(h, 0.5), (unsigned long long)quantile(h, 0.99));
+	}
+}
+
+#endif
@@ -0,0 +1,105 @@
+﻿#pragma once
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Встроенные замеры горячих мест: счётчики (вызовы func, шаги, отброшенные шаги R_K_DP,
+// выделения памяти, вызовы сплайна), гистограммы длительности фаз по степеням двойки
+// наносекунд и запись интервалов в формате Chrome trace (chrome://tracing, Perfetto).
+// Всё включается только при сборке с VM_RK_TRACE (в CMake - опция VM_RK_TRACE), иначе
+// макросы RK_TRACE_* пусты и ничего не стоят. Данные собираются в rk_trace.cpp (без /clr,
+// там же потоки, thread_local и атомарные операции), так что макросы можно ставить и в коде формы.
+// RK_TRACE_ADD пишет в счётчики своего потока; в общие они переносятся при выходе из
+// RK_TRACE_SCOPE и при завершении потока, так что rk_trace_count видит счёт другого
+// потока после его замера фазы (свой - всегда).
+
+enum rk_trace_counter {
+	rk_count_rhs,          // вычисления правой части (func, func_t, пакетные - по дорожкам)
+	rk_count_steps,        // шаги всех интеграторов (R_K_DP - принятые)
+	rk_count_rejected,     // отброшенные шаги R_K_DP
+	rk_count_alloc,        // выделения памяти (см. RK_TRACE_OPERATOR_NEW)
+	rk_count_spline_eval,  // вычисления cubic_spline::f
+	rk_count_total
+};
+
+enum rk_trace_phase {
+	rk_phase_integrate,
+	rk_phase_export,
+	rk_phase_spline_build,
+	rk_phase_spline_eval,
+	rk_phase_render,
+	rk_phase_total
+};
+
+#if defined(VM_RK_TRACE)
+
+void rk_trace_add(rk_trace_counter c, uint64_t n);
+uint64_t rk_trace_count(rk_trace_counter c);
+// Монотонное время в наносекундах
+uint64_t rk_trace_now();
+// Интервал фазы [start, end): в гистограмму и, пока есть место, в список событий;
+// заодно переносит счётчики потока в общие
+void rk_trace_record(rk_trace_phase p, uint64_t start, uint64_t end);
+// Обнуляет всё; max_events - сколько интервалов хранить для Chrome trace
+void rk_trace_reset(size_t max_events = (size_t)1 << 18);
+// JSON: traceEvents для просмотрщика, в otherData - счётчики и гистограммы
+bool rk_trace_write(const char* path);
+// Краткий текстовый отчёт: счётчики и для каждой фазы число, сумма, среднее, максимум, p50/p99
+void rk_trace_report(FILE* out);
+
+// Замер фазы на время жизни объекта
+class rk_trace_scope
+{
+public:
+	explicit rk_trace_scope(rk_trace_phase _p) : p(_p), start(rk_trace_now()) {}
+	~rk_trace_scope() { rk_trace_record(p, start, rk_trace_now()); }
+
+private:
+	rk_trace_scope(const rk_trace_scope&);
+	rk_trace_scope& operator=(const rk_trace_scope&);
+
+	rk_trace_phase p;
+	uint64_t start;
+};
+
+#define RK_TRACE_CAT2(a, b) a##b
+#define RK_TRACE_CAT(a, b) RK_TRACE_CAT2(a, b)
+#define RK_TRACE_ADD(counter, n) rk_trace_add(counter, (uint64_t)(n))
+#define RK_TRACE_SCOPE(phase) rk_trace_scope RK_TRACE_CAT(rk_trace_scope_, __LINE__)(phase)
+#define RK_TRACE_WRITE(path) rk_trace_write(path)
+
+// Подмена глобальных operator new/delete со счётом выделений - ставится один раз
+// в файл с main программы (не в код /clr). Размерные operator delete не подменяются
+// (стандартные вызывают operator delete(void*)), как и в rk_bench: заданные рядом
+// с operator new, они дают у GCC ложное -Wmismatched-new-delete. По той же причине
+// operator new не встраивается: иначе GCC видит malloc в паре с operator delete
+#if defined(__GNUC__) && !defined(__clang__)
+#define RK_TRACE_NO_SIZED_DELETE_WARNING _Pragma("GCC diagnostic ignored \"-Wsized-deallocation\"")
+#define RK_TRACE_NOINLINE __attribute__((noinline))
+#else
+#define RK_TRACE_NO_SIZED_DELETE_WARNING
+#define RK_TRACE_NOINLINE
+#endif
+#define RK_TRACE_OPERATOR_NEW() \
+	RK_TRACE_NO_SIZED_DELETE_WARNING \
+	RK_TRACE_NOINLINE void* operator new(size_t n) { \
+		rk_trace_add(rk_count_alloc, 1); \
+		void* p = malloc(n ? n : 1); \
+		if (!p) \
+			throw std::bad_alloc(); \
+		return p; \
+	} \
+	void* operator new[](size_t n) { return operator new(n); } \
+	void operator delete(void* p) noexcept { free(p); } \
+	void operator delete[](void* p) noexcept { free(p); }
+
+#else
+
+#define RK_TRACE_ADD(counter, n) ((void)0)
+#define RK_TRACE_SCOPE(phase) ((void)0)
+#define RK_TRACE_WRITE(path) ((void)0)
+#define RK_TRACE_OPERATOR_NEW()
+
+#endif
@@ -1,27 +1,76 @@
+#pragma once
 #include <stdio.h>
-#include <tchar.h>
 #include <math.h>
 #include <limits>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if !defined(_M_CEE)
+#include <thread>
+#include <vector>
+#endif
+#include "rk_trace.h"
 
 
 class cubic_spline
 {
 private:
-    // ,      
-    struct spline_tuple
-    {
-        double a, b, c, d, x;
-    };
- 
-    spline_tuple *splines; // 
+    //      ( ):
+    //   [xs[i - 1], xs[i]] S(x) = a[i] + b[i]dx + c[i]/2 dx^2 + d[i]/6 dx^3, dx = x - xs[i]
+    double *xs, *a, *b, *c, *d;
     size_t n; //   
+    size_t cap; //      -     cap    
+    double *alpha, *beta; //   ,    
+    double *pu, *pw; //       
+    size_t pcap;
+    unsigned threads; // 0 -  , 1 -  
+ 
+    //   :   (    )  
+    //    ,   -    lut,  lut[k] -
+    //      k-   1 / inv_h
+    bool uniform;
+    double inv_h;
+    size_t *lut, lut_n, lut_cap;
  
     void free_mem(); //  
+    void init(); //    
+    void copy_from(const cubic_spline &other);
+ 
+    //    x  : xs[j - 1] < x <= xs[j], 1 <= j <= n - 1
+    size_t find(double x) const;
+    //         
+    size_t locate(double x) const;
+    //      
+    void build_index();
+    //    m      
+    void eval(const double *x, const size_t *j, double *out, size_t m) const;
+    //    p  (. build_spline)
+    void build_parallel(const double *x, const double *y, unsigned p);
  
 public:
     cubic_spline(); //
     ~cubic_spline(); //
  
+    //  -  (),       
+    //  ,   std::vector<cubic_spline>   ,   
+    cubic_spline(const cubic_spline &other);
+    cubic_spline(cubic_spline &&other) noexcept;
+    cubic_spline &operator=(const cubic_spline &other);
+    cubic_spline &operator=(cubic_spline &&other) noexcept;
+    void swap(cubic_spline &other) noexcept;
+ 
+    //     n ;   
+    void reserve(size_t n);
+ 
+    //   : 0 -   n >= parallel_threshold   ,
+    // 1 -   , k > 1 -   k 
+    void set_threads(unsigned k) { threads = k; }
+    static const size_t parallel_threshold = 1 << 18;
+ 
     //  
     // x -  ,     ,   
     // y -     
@@ -30,37 +79,188 @@ public:
  
     //       
     double f(double x) const;
+ 
+    //  ,   f    x: xs[j - 1] < x <= xs[j],
+    //   - 1,  - n - 1 ( NaN -  ); 0 -   
+    size_t segment(double x) const;
+ 
+    //   m  : out[k] = f(x[k]).    
+    //      ,  -   
+    void f(const double *x, double *out, size_t m) const;
 };
  
-cubic_spline::cubic_spline() : splines(NULL)
+inline cubic_spline::cubic_spline()
 {
+    init();
+}
  
+inline cubic_spline::cubic_spline(const cubic_spline &other)
+{
+    init();
+    copy_from(other);
 }
  
-cubic_spline::~cubic_spline()
+inline cubic_spline::cubic_spline(cubic_spline &&other) noexcept
 {
-    free_mem();
+    init();
+    swap(other);
+}
+ 
+inline cubic_spline &cubic_spline::operator=(const cubic_spline &other)
+{
+    if (this != &other)
+        copy_from(other);
+    return *this;
+}
+ 
+inline cubic_spline &cubic_spline::operator=(cubic_spline &&other) noexcept
+{
+    if (this != &other)
+    {
+        free_mem();
+        swap(other);
+    }
+    return *this;
+}
+ 
+inline void cubic_spline::swap(cubic_spline &other) noexcept
+{
+    std::swap(xs, other.xs);
+    std::swap(a, other.a);
+    std::swap(b, other.b);
+    std::swap(c, other.c);
+    std::swap(d, other.d);
+    std::swap(n, other.n);
+    std::swap(cap, other.cap);
+    std::swap(alpha, other.alpha);
+    std::swap(beta, other.beta);
+    std::swap(pu, other.pu);
+    std::swap(pw, other.pw);
+    std::swap(pcap, other.pcap);
+    std::swap(threads, other.threads);
+    std::swap(uniform, other.uniform);
+    std::swap(inv_h, other.inv_h);
+    std::swap(lut, other.lut);
+    std::swap(lut_n, other.lut_n);
+    std::swap(lut_cap, other.lut_cap);
+}
+ 
+inline void cubic_spline::init()
+{
+    xs = a = b = c = d = alpha = beta = pu = pw = NULL;
+    n = cap = pcap = 0;
+    threads = 0;
+    uniform = false;
+    inv_h = 0.;
+    lut = NULL;
+    lut_n = lut_cap = 0;
+}
+ 
+inline void cubic_spline::copy_from(const cubic_spline &other)
+{
+    //    ,   
+    reserve(other.n);
+    n = other.n;
+    threads = other.threads;
+    if (n)
+    {
+        memcpy(xs, other.xs, n * sizeof(double));
+        memcpy(a, other.a, n * sizeof(double));
+        memcpy(b, other.b, n * sizeof(double));
+        memcpy(c, other.c, n * sizeof(double));
+        memcpy(d, other.d, n * sizeof(double));
+    }
+    uniform = other.uniform;
+    inv_h = other.inv_h;
+    lut_n = other.lut_n;
+    if (lut_n)
+    {
+        if (lut_cap < lut_n + 1)
+        {
+            delete[] lut;
+            lut = new size_t[lut_n + 1];
+            lut_cap = lut_n + 1;
+        }
+        memcpy(lut, other.lut, (lut_n + 1) * sizeof(size_t));
+    }
 }
  
-void cubic_spline::build_spline(const double *x, const double *y, size_t n)
+inline void cubic_spline::reserve(size_t n)
+{
+    if (n <= cap)
+        return;
+    //     :  new  ,   
+    double **arr[7] = { &xs, &a, &b, &c, &d, &alpha, &beta };
+    double *p[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    try
+    {
+        for (int i = 0; i < 7; ++i)
+            p[i] = new double[n];
+    }
+    catch (...)
+    {
+        for (int i = 0; i < 7; ++i)
+            delete[] p[i];
+        throw;
+    }
+    //    ,    - 
+    for (int i = 0; i < 7; ++i)
+    {
+        if (i < 5 && this->n)
+            memcpy(p[i], *arr[i], this->n * sizeof(double));
+        delete[] *arr[i];
+        *arr[i] = p[i];
+    }
+    cap = n;
+}
+ 
+inline cubic_spline::~cubic_spline()
 {
     free_mem();
+}
+ 
+inline void cubic_spline::build_spline(const double *x, const double *y, size_t n)
+{
+    RK_TRACE_SCOPE(rk_phase_spline_build);
+    //    -  , f  NaN ( n - 2    )
+    if (n < 2)
+    {
+        this->n = 0;
+        return;
+    }
+    reserve(n);
  
     this->n = n;
  
-    //   
-    splines = new spline_tuple[n];
+#if !defined(_M_CEE)
+    //     (  /clr  std::thread )
+    //    -   4  ,    n < 10  
+    unsigned p = threads;
+    if (p == 0)
+        p = n >= parallel_threshold ? std::thread::hardware_concurrency() : 1;
+    if (n < 10)
+        p = 1;
+    else if (p > (n - 2) / 4)
+        p = (unsigned)((n - 2) / 4);
+    if (p > 1)
+    {
+        build_parallel(x, y, p);
+        build_index();
+        return;
+    }
+#endif
+ 
+    //   
     for (size_t i = 0; i < n; ++i)
     {
-        splines[i].x = x[i];
-        splines[i].a = y[i];
+        xs[i] = x[i];
+        a[i] = y[i];
     }
-    splines[0].c = splines[n - 1].c = 0.;
+    b[0] = d[0] = 0.;
+    c[0] = c[n - 1] = 0.;
  
     //      c[i]     
     //    -    
-    double *alpha = new double[n - 1];
-    double *beta = new double[n - 1];
     alpha[0] = beta[0] = 0.;
     for (size_t i = 1; i < n - 1; ++i)
     {
@@ -76,57 +276,329 @@ void cubic_spline::build_spline(const double *x, const double *y, size_t n)
  
     //   -    
     for (size_t i = n - 2; i > 0; --i)
-        splines[i].c = alpha[i] * splines[i + 1].c + beta[i];
- 
-    //  ,   
-    delete[] beta;
-    delete[] alpha;
+        c[i] = alpha[i] * c[i + 1] + beta[i];
  
     //    c[i]   b[i]  d[i]
     for (size_t i = n - 1; i > 0; --i)
     {
         double h_i = x[i] - x[i - 1];
-        splines[i].d = (splines[i].c - splines[i - 1].c) / h_i;
-        splines[i].b = h_i * (2. * splines[i].c + splines[i - 1].c) / 6. + (y[i] - y[i - 1]) / h_i;
+        d[i] = (c[i] - c[i - 1]) / h_i;
+        b[i] = h_i * (2. * c[i] + c[i - 1]) / 6. + (y[i] - y[i - 1]) / h_i;
     }
+ 
+    build_index();
 }
  
-double cubic_spline::f(double x) const
+#if !defined(_M_CEE)
+inline void cubic_spline::build_parallel(const double *x, const double *y, unsigned p)
 {
-    if (!splines)
-        return std::numeric_limits<double>::quiet_NaN(); //      -  NaN
+    if (pcap < n)
+    {
+        delete[] pu;
+        delete[] pw;
+        pu = new double[n];
+        pw = new double[n];
+        pcap = n;
+    }
+ 
+    //   1..n-2   p .    , 
+    // , - :   c[hi[k]] = S[k].    
+    //   ,      :
+    // c[i] = Y[i] + U[i] * S[k - 1] + W[i] * S[k]  (Y   beta, U -  pu, W -  pw)
+    std::vector<size_t> lo(p), hi(p);
+    size_t m = n - 2;
+    for (unsigned k = 0; k < p; ++k)
+    {
+        lo[k] = 1 + m * k / p;
+        hi[k] = k + 1 < p ? m * (k + 1) / p : n - 1;
+    }
+    auto row = [x, y](size_t i, double &A, double &B, double &C, double &F)
+    {
+        double h_i = x[i] - x[i - 1], h_i1 = x[i + 1] - x[i];
+        A = h_i;
+        C = 2. * (h_i + h_i1);
+        B = h_i1;
+        F = 6. * ((y[i + 1] - y[i]) / h_i1 - (y[i] - y[i - 1]) / h_i);
+    };
+    auto run = [p](auto fn)
+    {
+        std::vector<std::thread> pool;
+        for (unsigned k = 1; k < p; ++k)
+            pool.emplace_back(fn, k);
+        fn(0u);
+        for (size_t k = 0; k < pool.size(); ++k)
+            pool[k].join();
+    };
  
-    spline_tuple *s;
-    if (x <= splines[0].x) //  x    x[0] -   - 
-        s = splines + 1;
-    else if (x >= splines[n - 1].x) //  x    x[n - 1] -   - 
-        s = splines + n - 1;
-    else //  x      -     - 
+    xs[0] = x[0];
+    a[0] = y[0];
+    xs[n - 1] = x[n - 1];
+    a[n - 1] = y[n - 1];
+    b[0] = d[0] = 0.;
+    c[0] = c[n - 1] = 0.;
+ 
+    //   
+    run([&](unsigned k)
     {
-        size_t i = 0, j = n - 1;
-        while (i + 1 < j)
+        for (size_t i = lo[k]; i <= hi[k] && i < n - 1; ++i)
         {
-            std::size_t k = i + (j - i) / 2;
-            if (x <= splines[k].x)
-                j = k;
-            else
-                i = k;
+            xs[i] = x[i];
+            a[i] = y[i];
         }
-        s = splines + j;
+        double A, B, C, F;
+        for (size_t i = lo[k]; i < hi[k]; ++i)
+        {
+            row(i, A, B, C, F);
+            bool first = i == lo[k];
+            double z = first ? C : A * alpha[i - 1] + C;
+            alpha[i] = -B / z;
+            beta[i] = (F - (first ? 0. : A * beta[i - 1])) / z;
+            pu[i] = (first ? -A : -A * pu[i - 1]) / z;
+        }
+        size_t last = hi[k] - 1;
+        pw[last] = alpha[last];
+        for (size_t i = last; i-- > lo[k];)
+        {
+            beta[i] += alpha[i] * beta[i + 1];
+            pu[i] += alpha[i] * pu[i + 1];
+            pw[i] = alpha[i] * pw[i + 1];
+        }
+    });
+ 
+    //     (p - 1 ) -  
+    std::vector<double> sa(p), sb(p);
+    for (unsigned k = 0; k + 1 < p; ++k)
+    {
+        size_t e = hi[k];
+        double A, B, C, F;
+        row(e, A, B, C, F);
+        double sub = A * pu[e - 1];
+        double diag = C + A * pw[e - 1] + B * pu[e + 1];
+        double sup = B * pw[e + 1];
+        double rhs = F - A * beta[e - 1] - B * beta[e + 1];
+        double z = diag + (k ? sub * sa[k - 1] : 0.);
+        sa[k] = -sup / z;
+        sb[k] = (rhs - (k ? sub * sb[k - 1] : 0.)) / z;
+    }
+    for (unsigned k = p - 1; k-- > 0;)
+        c[hi[k]] = sb[k] + (k + 2 < p ? sa[k] * c[hi[k + 1]] : 0.);
+ 
+    //  c[i]  
+    run([&](unsigned k)
+    {
+        double sl = k ? c[hi[k - 1]] : 0., sr = k + 1 < p ? c[hi[k]] : 0.;
+        for (size_t i = lo[k]; i < hi[k]; ++i)
+            c[i] = beta[i] + pu[i] * sl + pw[i] * sr;
+    });
+ 
+    //    c[i]   b[i]  d[i]
+    run([&](unsigned k)
+    {
+        size_t end = k + 1 < p ? lo[k + 1] : n;
+        for (size_t i = lo[k]; i < end; ++i)
+        {
+            double h_i = x[i] - x[i - 1];
+            d[i] = (c[i] - c[i - 1]) / h_i;
+            b[i] = h_i * (2. * c[i] + c[i - 1]) / 6. + (y[i] - y[i - 1]) / h_i;
+        }
+    });
+}
+#endif
+ 
+inline void cubic_spline::build_index()
+{
+    //   R_K  :  begin + k * h   
+    double h = (xs[n - 1] - xs[0]) / (n - 1);
+    uniform = h > 0.;
+    for (size_t i = 1; i < n - 1 && uniform; ++i)
+        uniform = fabs(xs[i] - (xs[0] + i * h)) <= 0.25 * h;
+    inv_h = uniform ? 1. / h : 0.;
+ 
+    //    -   (      )
+    lut_n = 0;
+    if (uniform || n < 64)
+        return;
+    lut_n = n;
+    if (lut_cap < lut_n + 1)
+    {
+        delete[] lut;
+        lut = new size_t[lut_n + 1];
+        lut_cap = lut_n + 1;
     }
+    inv_h = lut_n / (xs[n - 1] - xs[0]);
+    size_t j = 1;
+    for (size_t k = 0; k <= lut_n; ++k)
+    {
+        double edge = xs[0] + k / inv_h;
+        while (j < n - 1 && xs[j] < edge)
+            ++j;
+        lut[k] = j;
+    }
+}
  
-    double dx = (x - s->x);
+inline double cubic_spline::f(double x) const
+{
+    RK_TRACE_ADD(rk_count_spline_eval, 1); //    ,   
+    if (!n)
+        return std::numeric_limits<double>::quiet_NaN(); //      -  NaN
+ 
+    size_t s = segment(x);
+    double dx = (x - xs[s]);
 	//         
 	//( , ""      ,      ,  )
-    return s->a + (s->b + (s->c / 2. + s->d * dx / 6.) * dx) * dx;
+    return a[s] + (b[s] + (c[s] / 2. + d[s] * dx / 6.) * dx) * dx;
 }
-
-void cubic_spline::free_mem()
+ 
+inline size_t cubic_spline::segment(double x) const
+{
+    if (!n)
+        return 0;
+    if (x <= xs[0]) //  x    x[0] -   - 
+        return 1;
+    if (x >= xs[n - 1]) //  x    x[n - 1] -   - 
+        return n - 1;
+    return locate(x); //  x      -   -  (. locate)
+}
+ 
+inline size_t cubic_spline::find(double x) const
+{
+    //   ,   x;    
+    const double *base = xs;
+    size_t len = n;
+    while (len > 1)
+    {
+        size_t half = len / 2;
+        base = (base[half] < x) ? base + half : base;
+        len -= half;
+    }
+    size_t j = (size_t)(base - xs) + 1;
+    return j < n - 1 ? j : n - 1;
+}
+ 
+inline size_t cubic_spline::locate(double x) const
+{
+    size_t j;
+    if (uniform)
+    {
+        //    ,  
+        double u = (x - xs[0]) * inv_h;
+        if (!(u > 0.))
+            return 1;
+        j = u < n - 1 ? (size_t)u + 1 : n - 1;
+    }
+    else if (lut_n)
+    {
+        //     :     
+        double u = (x - xs[0]) * inv_h;
+        if (!(u > 0.))
+            return 1;
+        size_t k = u < lut_n ? (size_t)u : lut_n - 1;
+        size_t i = lut[k] - 1, hi = lut[k + 1];
+        while (i + 1 < hi)
+        {
+            size_t m = i + (hi - i) / 2;
+            if (x <= xs[m])
+                hi = m;
+            else
+                i = m;
+        }
+        j = hi;
+    }
+    else
+        return find(x);
+ 
+    //   :  j,    xs[j - 1] < x <= xs[j]
+    while (j > 1 && x <= xs[j - 1])
+        --j;
+    while (j < n - 1 && x > xs[j])
+        ++j;
+    return j;
+}
+ 
+inline void cubic_spline::eval(const double *x, const size_t *j, double *out, size_t m) const
+{
+    size_t k = 0;
+#if defined(__AVX2__)
+    //     gather-,   -  4 
+    const __m256d two = _mm256_set1_pd(2.), six = _mm256_set1_pd(6.);
+    for (; k + 4 <= m; k += 4)
+    {
+#if SIZE_MAX > 0xffffffffu
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(j + k));
+#define SPLINE_GATHER(p) _mm256_i64gather_pd(p, idx, 8)
+#else
+        __m128i idx = _mm_loadu_si128((const __m128i *)(j + k));
+#define SPLINE_GATHER(p) _mm256_i32gather_pd(p, idx, 8)
+#endif
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + k), SPLINE_GATHER(xs));
+        __m256d s = _mm256_div_pd(_mm256_mul_pd(SPLINE_GATHER(d), dx), six);
+        s = _mm256_mul_pd(_mm256_add_pd(_mm256_div_pd(SPLINE_GATHER(c), two), s), dx);
+        s = _mm256_mul_pd(_mm256_add_pd(SPLINE_GATHER(b), s), dx);
+        _mm256_storeu_pd(out + k, _mm256_add_pd(SPLINE_GATHER(a), s));
+#undef SPLINE_GATHER
+    }
+#endif
+    for (; k < m; ++k)
+    {
+        size_t s = j[k];
+        double dx = (x[k] - xs[s]);
+        out[k] = a[s] + (b[s] + (c[s] / 2. + d[s] * dx / 6.) * dx) * dx;
+    }
+}
+ 
+inline void cubic_spline::f(const double *x, double *out, size_t m) const
 {
-    if (splines)
+    RK_TRACE_SCOPE(rk_phase_spline_eval);
+    RK_TRACE_ADD(rk_count_spline_eval, m);
+    if (!n)
     {
-        delete[] splines;
-        splines = NULL;
+        for (size_t k = 0; k < m; ++k)
+            out[k] = std::numeric_limits<double>::quiet_NaN();
+        return;
     }
+ 
+    bool sorted = true;
+    for (size_t k = 1; k < m && sorted; ++k)
+        sorted = x[k - 1] <= x[k];
+ 
+    //   :   ,  
+    const size_t chunk = 256;
+    size_t j[chunk];
+    size_t s = 1;
+    for (size_t k0 = 0; k0 < m; k0 += chunk)
+    {
+        size_t cnt = m - k0 < chunk ? m - k0 : chunk;
+        if (sorted)
+        {
+            // :       x
+            for (size_t k = 0; k < cnt; ++k)
+            {
+                while (s < n - 1 && x[k0 + k] > xs[s])
+                    ++s;
+                j[k] = s;
+            }
+        }
+        else
+        {
+            for (size_t k = 0; k < cnt; ++k)
+                j[k] = locate(x[k0 + k]);
+        }
+        eval(x + k0, j, out + k0, cnt);
+    }
+}
+ 
+inline void cubic_spline::free_mem()
+{
+    delete[] xs;
+    delete[] a;
+    delete[] b;
+    delete[] c;
+    delete[] d;
+    delete[] alpha;
+    delete[] beta;
+    delete[] pu;
+    delete[] pw;
+    delete[] lut;
+    init();
 }
 
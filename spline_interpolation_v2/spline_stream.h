@@ -0,0 +1,160 @@
+﻿#pragma once
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+// Естественный кубический сплайн, узлы которого добавляются по одному (например, точки
+// R_K по мере счёта), без перестроения с нуля.
+// Прямой ход прогонки (alpha, beta узла) зависит только от предыдущих узлов, поэтому новый
+// узел добавляет одну строку. Обратный ход c[i] = alpha[i] c[i + 1] + beta[i] начинается с
+// естественного c = 0 на последнем узле, и изменение c на конце затухает назад как
+// |alpha|^k, |alpha| < 1/2 (на равномерной сетке 2 - sqrt(3) = 0.27). Поэтому обратный ход
+// повторяется только на последних window узлах, более ранние c считаются окончательными.
+// Отличие от build_spline по тем же узлам - не больше 2^-window от величины c
+// (на равномерной сетке 0.27^window). Обновление - O(window) вместо O(n).
+// При max_knots != 0 хранятся только последние max_knots узлов (скользящее окно),
+// сплайн определён на них, память ограничена.
+class spline_stream
+{
+public:
+	explicit spline_stream(size_t _window = 48, size_t _max_knots = 0) : window(_window ? _window : 1), max_knots(_max_knots), head(0), drop(0) {
+		if (max_knots && max_knots < window + 2)
+			max_knots = window + 2;
+	}
+
+	// Новый узел; x должен быть больше последнего, иначе узел не добавляется и возвращается false
+	bool push(double x, double y) {
+		if (!append(x, y))
+			return false;
+		settle(1);
+		return true;
+	}
+
+	// Пачка узлов: прямой ход по всем, обратный - один раз на m + window узлах.
+	// Узлы до первого неупорядоченного добавляются; возвращается их число.
+	size_t push(const double* x, const double* y, size_t m) {
+		size_t k = 0;
+		while (k < m && append(x[k], y[k]))
+			++k;
+		settle(k);
+		return k;
+	}
+
+	void clear() {
+		xs.clear();
+		ys.clear();
+		cs.clear();
+		al.clear();
+		be.clear();
+		head = 0;
+		drop = 0;
+	}
+
+	// Хранимые узлы и отрезок, на котором определён сплайн
+	size_t size() const { return xs.size() - head; }
+	double x_begin() const { return size() ? xs[head] : std::numeric_limits<double>::quiet_NaN(); }
+	double x_end() const { return size() ? xs.back() : std::numeric_limits<double>::quiet_NaN(); }
+	// Сколько узлов выброшено из-за max_knots
+	size_t dropped() const { return drop; }
+
+	// Значение в x; вне [x_begin(), x_end()] продолжаются крайние отрезки, как у cubic_spline::f
+	double f(double x) const {
+		size_t n = xs.size();
+		if (n - head < 2)
+			return n > head ? ys[head] : std::numeric_limits<double>::quiet_NaN();
+		size_t s;
+		if (x <= xs[head])
+			s = head + 1;
+		else if (x >= xs[n - 1])
+			s = n - 1;
+		else
+			s = std::lower_bound(xs.begin() + head, xs.end(), x) - xs.begin();
+		return eval(s, x);
+	}
+
+	// m точек; идущие по возрастанию проходятся слиянием с узлами, после шага назад - двоичный поиск
+	void f(const double* x, double* out, size_t m) const {
+		size_t n = xs.size();
+		if (n - head < 2) {
+			for (size_t k = 0; k < m; ++k)
+				out[k] = n > head ? ys[head] : std::numeric_limits<double>::quiet_NaN();
+			return;
+		}
+		size_t s = head + 1;
+		for (size_t k = 0; k < m; ++k) {
+			if (k && x[k] < x[k - 1]) {
+				s = std::lower_bound(xs.begin() + head, xs.end(), x[k]) - xs.begin();
+				if (s < head + 1)
+					s = head + 1;
+			}
+			while (s < n - 1 && x[k] > xs[s])
+				++s;
+			out[k] = eval(s, x[k]);
+		}
+	}
+
+private:
+	// Отрезок [xs[s - 1], xs[s]] в записи cubic_spline: a + b dx + c/2 dx^2 + d/6 dx^3, dx = x - xs[s]
+	double eval(size_t s, double x) const {
+		double h = xs[s] - xs[s - 1];
+		double d = (cs[s] - cs[s - 1]) / h;
+		double b = h * (2. * cs[s] + cs[s - 1]) / 6. + (ys[s] - ys[s - 1]) / h;
+		double dx = x - xs[s];
+		return ys[s] + (b + (cs[s] / 2. + d * dx / 6.) * dx) * dx;
+	}
+
+	// Добавляет узел и строку прямого хода для предпоследнего узла
+	bool append(double x, double y) {
+		size_t n = xs.size();
+		if (n > head && !(x > xs[n - 1]))
+			return false;
+		xs.push_back(x);
+		ys.push_back(y);
+		cs.push_back(0.);
+		al.push_back(0.);
+		be.push_back(0.);
+		++n;
+		if (n >= 3) {
+			size_t i = n - 2;
+			double h_i = xs[i] - xs[i - 1], h_i1 = xs[i + 1] - xs[i];
+			double F = 6. * ((ys[i + 1] - ys[i]) / h_i1 - (ys[i] - ys[i - 1]) / h_i);
+			double z = h_i * al[i - 1] + 2. * (h_i + h_i1);
+			al[i] = -h_i1 / z;
+			be[i] = (F - h_i * be[i - 1]) / z;
+		}
+		return true;
+	}
+
+	// Обратный ход на последних added + window узлах и сдвиг окна памяти
+	void settle(size_t added) {
+		size_t n = xs.size();
+		if (!added || n < 2)
+			return;
+		cs[n - 1] = 0.;
+		size_t span = added + window;
+		size_t stop = n - 1 > span ? n - 1 - span : 0;
+		if (stop < 1)
+			stop = 1;
+		for (size_t i = n - 2; i >= stop && i > 0; --i)
+			cs[i] = al[i] * cs[i + 1] + be[i];
+		if (!max_knots || n - head <= max_knots)
+			return;
+		drop += n - head - max_knots;
+		head = n - max_knots;
+		// Выброшенное начало стирается, когда его набралось не меньше хранимого: O(1) в среднем
+		if (head >= max_knots) {
+			xs.erase(xs.begin(), xs.begin() + head);
+			ys.erase(ys.begin(), ys.begin() + head);
+			cs.erase(cs.begin(), cs.begin() + head);
+			al.erase(al.begin(), al.begin() + head);
+			be.erase(be.begin(), be.begin() + head);
+			head = 0;
+		}
+	}
+
+	size_t window, max_knots;
+	std::vector<double> xs, ys, cs, al, be;
+	size_t head, drop;
+};
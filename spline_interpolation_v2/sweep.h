@@ -0,0 +1,178 @@
+﻿#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include "frk_vm.h"
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Привязка текущего потока к ядру core (по модулю числа ядер); там, где это не поддерживается, ничего не делает
+inline void rk_pin_thread(unsigned core) {
+	unsigned ncores = std::thread::hardware_concurrency();
+	if (ncores)
+		core %= ncores;
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)core;
+#endif
+}
+
+// Пул потоков с перехватом работы: у каждого потока своя очередь индексов задач,
+// свои задачи берутся с конца, а опустевший поток забирает задачи с начала чужих очередей.
+// Задачи не порождают новых задач, поэтому поток завершается, как только все очереди пусты.
+class work_stealing_pool
+{
+public:
+	// pin - привязать i-й поток к i-му ядру
+	explicit work_stealing_pool(unsigned threads = 0, bool _pin = false) : nthreads(threads), pin(_pin) {
+		if (nthreads == 0)
+			nthreads = std::thread::hardware_concurrency();
+		if (nthreads == 0)
+			nthreads = 1;
+	}
+
+	unsigned threads() const { return nthreads; }
+
+	// Выполняет task(i, worker) для всех i из [0, count) и ждёт завершения
+	template <class Task>
+	void run(size_t count, Task task) {
+		unsigned nt = (unsigned)(count < nthreads ? (count ? count : 1) : nthreads);
+		std::vector<queue> queues(nt);
+		// Начальное распределение - непрерывными блоками, соседние точки сетки обычно близки по стоимости
+		for (unsigned w = 0; w < nt; ++w)
+			for (size_t i = count * w / nt; i < count * (w + 1) / nt; ++i)
+				queues[w].q.push_back(i);
+
+		auto worker = [&](unsigned w) {
+			if (pin)
+				rk_pin_thread(w);
+			size_t i;
+			while (pop(queues[w], i) || steal(queues, w, i))
+				task(i, w);
+		};
+		std::vector<std::thread> pool;
+		for (unsigned w = 1; w < nt; ++w)
+			pool.emplace_back(worker, w);
+		worker(0);
+		for (size_t w = 0; w < pool.size(); ++w)
+			pool[w].join();
+	}
+
+private:
+	struct queue
+	{
+		std::mutex m;
+		std::deque<size_t> q;
+	};
+
+	static bool pop(queue& own, size_t& i) {
+		std::lock_guard<std::mutex> lock(own.m);
+		if (own.q.empty())
+			return false;
+		i = own.q.back();
+		own.q.pop_back();
+		return true;
+	}
+
+	static bool steal(std::vector<queue>& queues, unsigned self, size_t& i) {
+		for (size_t k = 1; k < queues.size(); ++k) {
+			queue& victim = queues[(self + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.m);
+			if (!victim.q.empty()) {
+				i = victim.q.front();
+				victim.q.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	unsigned nthreads;
+	bool pin;
+};
+
+// Равномерный диапазон значений параметра: count точек от from до to включительно
+struct sweep_range {
+	double from, to;
+	size_t count;
+
+	double at(size_t i) const { return count < 2 ? from : from + (to - from) * i / (count - 1); }
+};
+
+// Параметры одной траектории R_K
+struct sweep_point {
+	double begin, end, h;
+	double lambda, N, x0dash;
+};
+
+// Сетка параметров для R_K: все сочетания begin x end x h x lambda x N x x0dash.
+// Точка i: x0dash меняется быстрее всего, затем N, lambda, h, end, begin
+struct sweep_grid {
+	sweep_range lambda, N, x0dash;
+	sweep_range begin, end, h;
+
+	size_t size() const { return lambda.count * N.count * x0dash.count * h.count * end.count * begin.count; }
+
+	sweep_point at(size_t i) const {
+		sweep_point p;
+		p.x0dash = x0dash.at(i % x0dash.count);
+		i /= x0dash.count;
+		p.N = N.at(i % N.count);
+		i /= N.count;
+		p.lambda = lambda.at(i % lambda.count);
+		i /= lambda.count;
+		p.h = h.at(i % h.count);
+		i /= h.count;
+		p.end = end.at(i % end.count);
+		p.begin = begin.at(i / end.count);
+		return p;
+	}
+};
+
+// Результат одной траектории сетки; index - номер точки (см. sweep_grid::at)
+struct sweep_result {
+	size_t index;
+	double begin, end, h;
+	double lambda, N, x0dash;
+	std::vector<double> res, res_v;
+};
+
+// Считает все траектории сетки через R_K на threads потоках (0 - по числу ядер).
+// on_result вызывается сразу по готовности каждой траектории в порядке завершения,
+// вызовы сериализованы мьютексом, так что обработчику не нужна своя синхронизация.
+inline void sweep(const sweep_grid& grid, const std::function<void(sweep_result&)>& on_result, unsigned threads = 0) {
+	work_stealing_pool pool(threads);
+	std::mutex out;
+	pool.run(grid.size(), [&](size_t i, unsigned) {
+		sweep_point p = grid.at(i);
+		sweep_result r;
+		r.index = i;
+		r.begin = p.begin;
+		r.end = p.end;
+		r.h = p.h;
+		r.lambda = p.lambda;
+		r.N = p.N;
+		r.x0dash = p.x0dash;
+		R_K(p.begin, p.end, p.h, p.lambda, p.x0dash, p.N, r.res, r.res_v);
+		std::lock_guard<std::mutex> lock(out);
+		on_result(r);
+	});
+}
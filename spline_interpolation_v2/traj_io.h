@@ -0,0 +1,530 @@
+﻿#pragma once
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <charconv>
+#if !defined(_M_CEE)
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#endif
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Двоичный формат траектории (.rktr):
+//   заголовок traj_header (64 байта), затем блоки: uint64 n, n значений t, n значений x, n значений v.
+// Число точек count дописывается в заголовок при закрытии файла. Числа пишутся в порядке
+// байтов писавшей машины, и он отмечен в byte_order: файлы с другим порядком не читаются
+// (0 - файл, записанный до появления отметки).
+struct traj_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t block;
+	uint32_t byte_order;  // traj_byte_order в порядке байтов писавшей машины
+	uint64_t count;
+	double begin, h, lambda, x0dash, N;
+};
+
+static const uint32_t traj_byte_order = 0x01020304u;
+
+inline bool traj_header_ok(const traj_header& hd) {
+	return memcmp(hd.magic, "RKTR", 4) == 0 && (hd.byte_order == traj_byte_order || hd.byte_order == 0);
+}
+
+inline traj_header traj_make_header(double begin, double h, double lambda, double x0dash, double N) {
+	traj_header hd;
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, "RKTR", 4);
+	hd.version = 1;
+	hd.byte_order = traj_byte_order;
+	hd.begin = begin;
+	hd.h = h;
+	hd.lambda = lambda;
+	hd.x0dash = x0dash;
+	hd.N = N;
+	return hd;
+}
+
+struct traj_block {
+	std::vector<double> t, x, v;
+	size_t n;
+};
+
+#if !defined(_M_CEE)
+// Фоновая запись: заполненные блоки уходят в очередь, поток пишет их на диск и возвращает пустыми
+struct traj_async {
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<traj_block*> full, empty;
+	std::thread worker;
+	bool stop;
+	size_t blocks;
+};
+#endif
+
+// Потоковая запись траектории в двоичный формат большими блоками.
+// При background = true блоки пишет отдельный поток, и push не ждёт диска,
+// пока в очереди меньше max_blocks блоков. В коде /clr запись всегда синхронная.
+class traj_writer
+{
+public:
+	traj_writer() : f(NULL), cur(NULL), count(0), async(NULL) {}
+	~traj_writer() { close(); }
+
+	bool open(const char* path, const traj_header& header, size_t block = 1 << 16, bool background = true) {
+		close();
+		f = fopen(path, "wb");
+		if (!f)
+			return false;
+		setvbuf(f, NULL, _IOFBF, 1 << 20);
+		if (block < 1)
+			block = 1;
+		if (block > UINT32_MAX)
+			block = UINT32_MAX;
+		hd = header;
+		hd.block = (uint32_t)block;
+		hd.count = 0;
+		count = 0;
+		fwrite(&hd, sizeof(hd), 1, f);
+		cur = new_block();
+#if !defined(_M_CEE)
+		if (background) {
+			async = new traj_async;
+			async->stop = false;
+			async->blocks = 1;
+			async->worker = std::thread(&traj_writer::drain, this);
+		}
+#else
+		(void)background;
+#endif
+		return true;
+	}
+
+	// Без успешного open ничего не пишется
+	void push(double t, double x, double v) {
+		if (!f)
+			return;
+		traj_block& b = *cur;
+		b.t[b.n] = t;
+		b.x[b.n] = x;
+		b.v[b.n] = v;
+		if (++b.n == hd.block)
+			submit();
+	}
+
+	void push(const double* t, const double* x, const double* v, size_t n) {
+		for (size_t i = 0; i < n; ++i)
+			push(t[i], x[i], v[i]);
+	}
+
+	bool close() {
+		if (!f)
+			return true;
+		if (cur->n)
+			submit();
+#if !defined(_M_CEE)
+		if (async) {
+			{
+				std::lock_guard<std::mutex> lock(async->m);
+				async->stop = true;
+			}
+			async->cv.notify_all();
+			async->worker.join();
+			for (size_t i = 0; i < async->empty.size(); ++i)
+				delete async->empty[i];
+			delete async;
+			async = NULL;
+		}
+#endif
+		delete cur;
+		cur = NULL;
+		hd.count = count;
+		bool ok = !ferror(f);
+		fseek(f, 0, SEEK_SET);
+		ok = fwrite(&hd, sizeof(hd), 1, f) == 1 && ok;
+		ok = fclose(f) == 0 && ok;
+		f = NULL;
+		return ok;
+	}
+
+	static const size_t max_blocks = 8;
+
+private:
+	traj_block* new_block() {
+		traj_block* b = new traj_block;
+		b->t.resize(hd.block);
+		b->x.resize(hd.block);
+		b->v.resize(hd.block);
+		b->n = 0;
+		return b;
+	}
+
+	void write_block(const traj_block& b) {
+		uint64_t n = b.n;
+		fwrite(&n, sizeof(n), 1, f);
+		fwrite(b.t.data(), sizeof(double), b.n, f);
+		fwrite(b.x.data(), sizeof(double), b.n, f);
+		fwrite(b.v.data(), sizeof(double), b.n, f);
+	}
+
+	void submit() {
+		count += cur->n;
+#if !defined(_M_CEE)
+		if (async) {
+			std::unique_lock<std::mutex> lock(async->m);
+			async->full.push_back(cur);
+			async->cv.notify_all();
+			if (async->empty.empty() && async->blocks < max_blocks) {
+				++async->blocks;
+				lock.unlock();
+				cur = new_block();
+				return;
+			}
+			async->cv.wait(lock, [this] { return !async->empty.empty(); });
+			cur = async->empty.front();
+			async->empty.pop_front();
+			cur->n = 0;
+			return;
+		}
+#endif
+		write_block(*cur);
+		cur->n = 0;
+	}
+
+#if !defined(_M_CEE)
+	void drain() {
+		std::unique_lock<std::mutex> lock(async->m);
+		for (;;) {
+			async->cv.wait(lock, [this] { return async->stop || !async->full.empty(); });
+			if (async->full.empty())
+				return;
+			traj_block* b = async->full.front();
+			async->full.pop_front();
+			lock.unlock();
+			write_block(*b);
+			lock.lock();
+			async->empty.push_back(b);
+			async->cv.notify_all();
+		}
+	}
+#endif
+
+	FILE* f;
+	traj_header hd;
+	traj_block* cur;
+	uint64_t count;
+#if !defined(_M_CEE)
+	traj_async* async;
+#else
+	void* async;
+#endif
+};
+
+// Чтение файла .rktr через отображение в память: блоки доступны без копирования
+class traj_file
+{
+public:
+	traj_file() : data(NULL), size(0) {
+#if defined(_WIN32)
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+	~traj_file() { close(); }
+
+	bool open(const char* path) {
+		close();
+#if defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER sz;
+		GetFileSizeEx(file, &sz);
+		size = (size_t)sz.QuadPart;
+		mapping = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		fstat(fd, &st);
+		size = (size_t)st.st_size;
+		void* p = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+		::close(fd);
+		data = p == MAP_FAILED ? NULL : (const char*)p;
+#endif
+		if (!data || size < sizeof(traj_header) || !traj_header_ok(*reinterpret_cast<const traj_header*>(data))) {
+			close();
+			return false;
+		}
+		// Индекс блоков
+		for (size_t off = sizeof(traj_header); off + sizeof(uint64_t) <= size;) {
+			uint64_t n;
+			memcpy(&n, data + off, sizeof(n));
+			if (off + sizeof(n) + 3 * n * sizeof(double) > size)
+				break;
+			offsets.push_back(off);
+			off += sizeof(n) + 3 * n * sizeof(double);
+		}
+		return true;
+	}
+
+	void close() {
+		offsets.clear();
+#if defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	const traj_header& header() const { return *reinterpret_cast<const traj_header*>(data); }
+	size_t blocks() const { return offsets.size(); }
+
+	// Указатели на столбцы i-го блока внутри отображения
+	size_t block(size_t i, const double*& t, const double*& x, const double*& v) const {
+		uint64_t n;
+		memcpy(&n, data + offsets[i], sizeof(n));
+		t = reinterpret_cast<const double*>(data + offsets[i] + sizeof(n));
+		x = t + n;
+		v = x + n;
+		return (size_t)n;
+	}
+
+	void read_all(std::vector<double>& t, std::vector<double>& x, std::vector<double>& v) const {
+		for (size_t i = 0; i < blocks(); ++i) {
+			const double *bt, *bx, *bv;
+			size_t n = block(i, bt, bx, bv);
+			t.insert(t.end(), bt, bt + n);
+			x.insert(x.end(), bx, bx + n);
+			v.insert(v.end(), bv, bv + n);
+		}
+	}
+
+private:
+	const char* data;
+	size_t size;
+	std::vector<size_t> offsets;
+#if defined(_WIN32)
+	HANDLE file, mapping;
+#endif
+};
+
+// Абсолютное смещение в файле и размер файла - 64-битные и на Windows
+inline bool traj_seek(FILE* f, uint64_t off, int whence = SEEK_SET) {
+#if defined(_WIN32)
+	return _fseeki64(f, (__int64)off, whence) == 0;
+#else
+	return fseeko(f, (off_t)off, whence) == 0;
+#endif
+}
+
+inline bool traj_size(FILE* f, uint64_t& size) {
+	if (!traj_seek(f, 0, SEEK_END))
+		return false;
+#if defined(_WIN32)
+	__int64 n = _ftelli64(f);
+#else
+	off_t n = ftello(f);
+#endif
+	size = (uint64_t)n;
+	return n >= 0;
+}
+
+// Чтение .rktr без отображения в память: столбцы блоков читаются прямо в конец векторов,
+// без промежуточной копии (t, x или v может быть NULL - тогда столбец пропускается).
+// Читаются только блоки, целиком лежащие в файле, и не больше count точек заголовка,
+// так что у незакрытого файла (count = 0) точек нет. false - файл не открылся, не .rktr
+// или с другим порядком байтов, или не прочитался.
+inline bool traj_read(const char* path, traj_header& hd, std::vector<double>* t, std::vector<double>* x, std::vector<double>* v) {
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return false;
+	uint64_t size = 0;
+	bool ok = fread(&hd, sizeof(hd), 1, f) == 1 && traj_header_ok(hd) && traj_size(f, size);
+	std::vector<double>* cols[3] = { t, x, v };
+	if (ok) {
+		uint64_t fit = (size - sizeof(hd)) / (3 * sizeof(double));
+		for (int c = 0; c < 3; ++c)
+			if (cols[c])
+				cols[c]->reserve(cols[c]->size() + (size_t)(hd.count < fit ? hd.count : fit));
+	}
+	uint64_t got = 0;
+	for (uint64_t off = sizeof(hd); ok && got < hd.count && off + sizeof(uint64_t) <= size;) {
+		uint64_t n;
+		ok = traj_seek(f, off) && fread(&n, sizeof(n), 1, f) == 1;
+		if (!ok || n > hd.count - got || n > (size - off - sizeof(n)) / (3 * sizeof(double)))
+			break;
+		for (int c = 0; ok && c < 3; ++c) {
+			if (!cols[c])
+				continue;
+			size_t at = cols[c]->size();
+			cols[c]->resize(at + (size_t)n);
+			ok = traj_seek(f, off + sizeof(n) + c * n * sizeof(double)) && fread(cols[c]->data() + at, sizeof(double), (size_t)n, f) == n;
+		}
+		off += sizeof(n) + 3 * n * sizeof(double);
+		got += n;
+	}
+	fclose(f);
+	return ok;
+}
+
+// Буфер текстового вывода: числа форматируются std::to_chars, поэтому результат не зависит
+// от локали; вывод копится в большом буфере и пишется в файл крупными кусками.
+class text_out
+{
+public:
+	text_out() : f(NULL) {}
+	~text_out() { close(); }
+
+	// text - концы строк по правилам платформы (на Windows "\r\n", как у std::ofstream)
+	bool open(const char* path, bool text = false) {
+		close();
+		f = fopen(path, text ? "w" : "wb");
+		if (!f)
+			return false;
+		buf.reserve(1 << 20);
+		return true;
+	}
+
+	bool close() {
+		if (!f)
+			return true;
+		flush();
+		bool ok = !ferror(f);
+		ok = fclose(f) == 0 && ok;
+		f = NULL;
+		return ok;
+	}
+
+	bool is_open() const { return f != NULL; }
+
+	// Число, дополненное слева пробелами до width символов
+	void put(double a, std::chars_format fmt, int precision, size_t width = 0) {
+		char s[128];
+		std::to_chars_result r = std::to_chars(s, s + sizeof(s), a, fmt, precision);
+		if (r.ec != std::errc())
+			r = std::to_chars(s, s + sizeof(s), a, std::chars_format::scientific, precision);
+		pad((size_t)(r.ptr - s), width);
+		buf.insert(buf.end(), s, r.ptr);
+	}
+
+	void put(const char* s, size_t width = 0) {
+		size_t n = strlen(s);
+		pad(n, width);
+		buf.insert(buf.end(), s, s + n);
+	}
+
+	void put(char c) { buf.push_back(c); }
+
+	// Конец строки; буфер сбрасывается, когда почти полон
+	void line() {
+		buf.push_back('\n');
+		if (buf.size() > (1 << 20) - 1024)
+			flush();
+	}
+
+private:
+	void pad(size_t n, size_t width) {
+		if (n < width)
+			buf.insert(buf.end(), width - n, ' ');
+	}
+
+	void flush() {
+		if (!buf.empty())
+			fwrite(buf.data(), 1, buf.size(), f);
+		buf.clear();
+	}
+
+	FILE* f;
+	std::vector<char> buf;
+};
+
+// Текстовая выгрузка "t,x,v" с фиксированным числом знаков после запятой
+class csv_writer
+{
+public:
+	csv_writer() : precision(10) {}
+
+	bool open(const char* path, int _precision = 10) {
+		if (!out.open(path))
+			return false;
+		precision = _precision;
+		out.put("t,x,v");
+		out.line();
+		return true;
+	}
+
+	void push(double t, double x, double v) {
+		if (!out.is_open())
+			return;
+		out.put(t, std::chars_format::fixed, precision);
+		out.put(',');
+		out.put(x, std::chars_format::fixed, precision);
+		out.put(',');
+		out.put(v, std::chars_format::fixed, precision);
+		out.line();
+	}
+
+	bool close() { return out.close(); }
+
+private:
+	text_out out;
+	int precision;
+};
+
+// Таблица в прежнем формате Output.txt формы: заголовок и строки "x v t", второй и третий
+// столбцы выровнены вправо по 20 символов, числа - как у std::ostream по умолчанию
+// (6 значащих цифр, %g), но без зависимости от локали и без сброса буфера на каждой строке
+class table_writer
+{
+public:
+	bool open(const char* path) {
+		if (!out.open(path, true))
+			return false;
+		out.put("x");
+		out.put("v", 20);
+		out.put("t", 20);
+		out.line();
+		return true;
+	}
+
+	void push(double t, double x, double v) {
+		if (!out.is_open())
+			return;
+		out.put(x, std::chars_format::general, 6);
+		out.put(v, std::chars_format::general, 6, 20);
+		out.put(t, std::chars_format::general, 6, 20);
+		out.line();
+	}
+
+	bool close() { return out.close(); }
+
+private:
+	text_out out;
+};
@@ -0,0 +1,1076 @@
+﻿// Проверки вычислительной части (ctest): rk_tests [SUBSTRING] - только случаи с SUBSTRING в имени.
+// Каждый случай проверяет утверждение, на которое опирается код или его описание,
+// а не замеряет скорость (для этого rk_bench).
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <limits>
+#include <new>
+#include "frk_vm.h"
+#include "sweep.h"
+#include "traj_io.h"
+#include "spline.h"
+#include "rk_symplectic.h"
+#include "decimate.h"
+#include "rk_async.h"
+#include "rk_cache.h"
+#include "rk_tableau.h"
+#include "parareal.h"
+#include "rk_precision.h"
+#include "spline_stream.h"
+#include "rk_batch.h"
+#include "rk_events.h"
+#include "lyapunov.h"
+
+static int failures;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			++failures; \
+			fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while (0)
+
+#define CHECK_NEAR(a, b, tol) \
+	do { \
+		double a_ = (a), b_ = (b); \
+		if (!(fabs(a_ - b_) <= (tol))) { \
+			++failures; \
+			fprintf(stderr, "  %s:%d: |%s - %s| = %.3g > %.3g\n", __FILE__, __LINE__, #a, #b, fabs(a_ - b_), (double)(tol)); \
+		} \
+	} while (0)
+
+struct test_case {
+	const char* name;
+	std::function<void()> body;
+};
+
+// R_K_DP в узлах сетки R_K совпадает с мелкошаговым RK4 в пределах допуска
+static void test_dp_matches_rk4() {
+	std::vector<double> res, res_v, ref, ref_v;
+	dp_stats st = R_K_DP(0, 10, 0.1, 3, 1, 3, res, res_v, 1e-10, 1e-10);
+	CHECK(st.ok);
+	CHECK(res.size() == R_K_steps(0, 10, 0.1));
+	R_K(0, 10, 1e-4, 3, 1, 3, ref, ref_v);
+	for (size_t k = 0; k < res.size(); ++k) {
+		CHECK_NEAR(res[k], ref[k * 1000], 1e-7);
+		CHECK_NEAR(res_v[k], ref_v[k * 1000], 1e-7);
+	}
+}
+
+// Погрешность NaN или шаг, ушедший в ноль, - отказ, а не бесконечный цикл
+static void test_dp_fails_instead_of_hanging() {
+	std::vector<double> res, res_v;
+	dp_stats st = R_K_DP(0, 10, 0.01, 1e10, 1e308, 3, res, res_v);
+	CHECK(!st.ok);
+	CHECK(st.t < 10);
+	CHECK(st.nreject <= dp_max_rejects + 1);
+	CHECK(res.size() < R_K_steps(0, 10, 0.01));
+}
+
+// sweep обходит все сочетания шести диапазонов, и каждая траектория - та же, что у R_K
+static void test_sweep_covers_grid() {
+	sweep_grid g = { { 1, 2, 2 }, { 3, 3, 1 }, { -1, 1, 3 }, { 0, 1, 2 }, { 5, 6, 2 }, { 0.1, 0.05, 2 } };
+	CHECK(g.size() == 2 * 3 * 2 * 2 * 2);
+	std::vector<int> seen(g.size());
+	sweep(g, [&](sweep_result& r) {
+		sweep_point p = g.at(r.index);
+		++seen[r.index];
+		CHECK(r.begin == p.begin && r.end == p.end && r.h == p.h);
+		CHECK(r.lambda == p.lambda && r.N == p.N && r.x0dash == p.x0dash);
+		std::vector<double> res, res_v;
+		R_K(p.begin, p.end, p.h, p.lambda, p.x0dash, p.N, res, res_v);
+		CHECK(r.res == res && r.res_v == res_v);
+	}, 3);
+	for (size_t i = 0; i < seen.size(); ++i)
+		CHECK(seen[i] == 1);
+	sweep_point last = g.at(g.size() - 1);
+	CHECK(last.begin == 1 && last.end == 6 && last.h == 0.05 && last.lambda == 2 && last.x0dash == 1);
+}
+
+// Продолжение R_K_extend кусками (и через контрольную точку) совпадает с R_K с нуля бит в бит
+static void test_resume_bit_identical() {
+	std::vector<double> ref, ref_v;
+	rk_point p = R_K(0, 50, 0.01, 3, 1, 3, ref, ref_v);
+	std::vector<double> res, res_v;
+	rk_state s = R_K_start(0, 0.01, 3, 1, 3);
+	const double ends[] = { 0.37, 10, 10, 23.455, 49.99 };
+	for (size_t k = 0; k < sizeof(ends) / sizeof(ends[0]); ++k)
+		R_K_extend(s, ends[k], res, res_v);
+	std::stringstream ck;
+	CHECK(R_K_save(s, ck));
+	CHECK(ck.str().size() == 4 + 9 * 8);
+	rk_state r = R_K_start(0, 1, 0, 0, 0);
+	CHECK(R_K_load(r, ck));
+	CHECK(r.begin == s.begin && r.x0dash == s.x0dash && r.t == s.t && r.x == s.x && r.v == s.v);
+	CHECK(r.h == s.h && r.lambda == s.lambda && r.N == s.N && r.steps == s.steps);
+	R_K_extend(r, 50, res, res_v);
+	CHECK(res == ref && res_v == ref_v);
+	CHECK(r.x == p.x && r.v == p.v);
+	CHECK(r.steps == R_K_steps(0, 50, 0.01));
+}
+
+// Повреждённая или обрезанная контрольная точка не читается
+static void test_checkpoint_rejects_bad_input() {
+	rk_state s = R_K_start(1, 0.5, 2, 3, 4), r = s;
+	std::stringstream ck;
+	R_K_save(s, ck);
+	std::string bytes = ck.str();
+	CHECK((unsigned char)bytes[4] == 0 && (unsigned char)bytes[11] == 0x3f); // begin = 1.0, little-endian
+	std::stringstream cut(bytes.substr(0, bytes.size() - 1));
+	CHECK(!R_K_load(r, cut));
+	std::string bad = bytes;
+	bad[3] = '1';
+	std::stringstream old(bad);
+	CHECK(!R_K_load(r, old));
+}
+
+static std::string read_file(const char* path) {
+	std::ifstream f(path, std::ios::binary);
+	std::stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+// table_writer пишет Output.txt байт в байт как прежний std::ofstream с setw(20)
+static void test_output_txt_layout() {
+	const double t[] = { 0, 0.01, 12.5, 1e-7, 123456789 };
+	const double x[] = { 1, -0.333333333, 2.5e10, 0, -1e-300 };
+	const double v[] = { 3.14159265, 0, -7, 1e300, 42 };
+	{
+		std::ofstream ofs("rk_tests_old.txt");
+		ofs << "x" << std::setw(20) << "v" << std::setw(20) << "t" << std::endl;
+		for (int i = 0; i < 5; ++i)
+			ofs << x[i] << std::setw(20) << v[i] << std::setw(20) << t[i] << std::endl;
+	}
+	table_writer w;
+	CHECK(w.open("rk_tests_new.txt"));
+	for (int i = 0; i < 5; ++i)
+		w.push(t[i], x[i], v[i]);
+	CHECK(w.close());
+	CHECK(read_file("rk_tests_old.txt") == read_file("rk_tests_new.txt"));
+	remove("rk_tests_old.txt");
+	remove("rk_tests_new.txt");
+}
+
+// traj_writer: push без open ничего не делает, block = 0 считается за 1
+static void test_traj_writer_guards() {
+	traj_writer idle;
+	idle.push(1, 2, 3);
+	CHECK(idle.close());
+	traj_writer w;
+	CHECK(w.open("rk_tests.rktr", traj_make_header(0, 0.5, 3, 1, 3), 0, false));
+	for (int i = 0; i < 3; ++i)
+		w.push(0.5 * i, i, -i);
+	CHECK(w.close());
+	traj_file f;
+	CHECK(f.open("rk_tests.rktr"));
+	CHECK(f.header().count == 3 && f.header().block == 1 && f.blocks() == 3);
+	std::vector<double> tt, xx, vv;
+	f.read_all(tt, xx, vv);
+	CHECK(tt.size() == 3 && tt[2] == 1 && xx[2] == 2 && vv[2] == -2);
+	f.close();
+	remove("rk_tests.rktr");
+}
+
+static_assert(std::is_nothrow_move_constructible<cubic_spline>::value, "vector<cubic_spline> would copy on growth");
+static_assert(std::is_nothrow_move_assignable<cubic_spline>::value, "cubic_spline move assignment must not throw");
+
+// При росте vector<cubic_spline> сплайны перемещаются: массивы остаются те же
+static void test_spline_vector_moves() {
+	double x[16], y[16];
+	for (int i = 0; i < 16; ++i) {
+		x[i] = i * 0.5;
+		y[i] = sin(x[i]);
+	}
+	std::vector<cubic_spline> v(1);
+	v[0].build_spline(x, y, 16);
+	double before = v[0].f(3.3);
+	const cubic_spline* old = v.data();
+	while (v.data() == old)
+		v.emplace_back();
+	CHECK(v[0].f(3.3) == before);
+	cubic_spline moved(std::move(v[0]));
+	CHECK(moved.f(3.3) == before);
+}
+
+// Параллельная прогонка даёт тот же сплайн, что и последовательная (с точностью до нескольких ulp)
+static void test_parallel_spline_matches_serial() {
+	const size_t n = 100003;
+	std::vector<double> x(n), y(n);
+	for (size_t i = 0; i < n; ++i) {
+		x[i] = i * 0.01 + 0.004 * sin(i * 0.7);
+		y[i] = sin(x[i]) + 0.3 * cos(3.1 * x[i]);
+	}
+	cubic_spline serial, parallel;
+	serial.set_threads(1);
+	serial.build_spline(x.data(), y.data(), n);
+	const unsigned ps[] = { 2, 3, 8 };
+	for (size_t k = 0; k < sizeof(ps) / sizeof(ps[0]); ++k) {
+		parallel.set_threads(ps[k]);
+		parallel.build_spline(x.data(), y.data(), n);
+		double worst = 0;
+		for (size_t i = 0; i + 1 < n; i += 7) {
+			double q = 0.5 * (x[i] + x[i + 1]);
+			worst = fmax(worst, fabs(parallel.f(q) - serial.f(q)));
+		}
+		CHECK(worst <= 1e-13);
+	}
+	// Малые сетки при заданном числе потоков строятся последовательно, меньше двух узлов - пустой сплайн
+	for (size_t m = 0; m < 2; ++m) {
+		cubic_spline e;
+		e.set_threads(8);
+		e.build_spline(x.data(), y.data(), m);
+		CHECK(std::isnan(e.f(0.5)));
+	}
+	for (size_t m = 2; m < 12; ++m) {
+		cubic_spline a, b;
+		a.set_threads(1);
+		b.set_threads(8);
+		a.build_spline(x.data(), y.data(), m);
+		b.build_spline(x.data(), y.data(), m);
+		CHECK(a.f(x[m - 1] * 0.37) == b.f(x[m - 1] * 0.37));
+	}
+}
+
+// Наибольшее отклонение энергии от начальной на [k0, k1)
+static double energy_error(const std::vector<double>& x, const std::vector<double>& v, size_t k0, size_t k1) {
+	double e0 = rk_energy(x[0], v[0]), worst = 0;
+	for (size_t k = k0; k < k1; ++k)
+		worst = fmax(worst, fabs(rk_energy(x[k], v[k]) - e0));
+	return worst;
+}
+
+// При lambda = 0 ошибка энергии симплектических схем на t = 1e5 ограничена, у RK4 - растёт
+static void test_symplectic_energy_bounded() {
+	const double T = 1e5;
+	std::vector<double> x, v;
+	R_K_symplectic(0, T, 0.2, 0, 1, 3, x, v, rk_yoshida4);
+	size_t n = x.size();
+	double first = energy_error(x, v, 0, n / 2), second = energy_error(x, v, n / 2, n);
+	CHECK(fmax(first, second) < 1e-4);
+	CHECK(second < 2 * first);
+	x.clear();
+	v.clear();
+	R_K_symplectic(0, T, 0.1, 0, 1, 3, x, v, rk_verlet);
+	n = x.size();
+	first = energy_error(x, v, 0, n / 2);
+	second = energy_error(x, v, n / 2, n);
+	CHECK(fmax(first, second) < 2e-3);
+	CHECK(second < 2 * first);
+	x.clear();
+	v.clear();
+	R_K(0, T, 0.1, 0, 1, 3, x, v);
+	n = x.size();
+	first = energy_error(x, v, 0, n / 2);
+	second = energy_error(x, v, n / 2, n);
+	CHECK(second > 1e-3);
+	CHECK(second > 1.5 * first);
+}
+
+// Мин-макс даёт не больше 4 точек на каждый из columns столбцов, правый край - в последнем
+static void test_decimate_column_count() {
+	const size_t n = 10001, columns = 100;
+	std::vector<double> x(n), y(n);
+	for (size_t i = 0; i < n; ++i) {
+		x[i] = i * 0.01;
+		y[i] = sin(7 * x[i]);
+	}
+	std::vector<xy_point> out;
+	decimate(x.data(), y.data(), n, columns, decimate_minmax, out);
+	double width = (x[n - 1] - x[0]) / columns;
+	std::vector<int> per(columns);
+	for (size_t k = 0; k < out.size(); ++k) {
+		size_t c = (size_t)floor((out[k].x - x[0]) / width);
+		++per[c < columns ? c : columns - 1];
+	}
+	int used = 0;
+	for (size_t c = 0; c < columns; ++c) {
+		CHECK(per[c] <= 4);
+		used += per[c] > 0;
+	}
+	CHECK(used == (int)columns);
+	CHECK(out.size() <= 4 * columns);
+	CHECK(out.front().x == x[0] && out.back().x == x[n - 1]);
+}
+
+// Продолжение тем же minmax_decimator: peek показывает незаконченный столбец, не закрывая его,
+// и после дозаписи выход тот же, что за один проход, - столбец на стыке не повторяется
+static void test_decimate_peek_continues_column() {
+	const size_t n = 5000, cut = 2345;
+	std::vector<double> x(n), y(n);
+	for (size_t i = 0; i < n; ++i) {
+		x[i] = i * 0.01;
+		y[i] = sin(7 * x[i]) + 0.1 * sin(50 * x[i]);
+	}
+	minmax_decimator one(0, 0.37), parts(0, 0.37);
+	std::vector<xy_point> ref, out, tail, closed;
+	one.push(x.data(), y.data(), n, ref);
+	one.flush(ref);
+	parts.push(x.data(), y.data(), cut, out);
+	size_t shown = parts.peek(tail);
+	CHECK(shown == tail.size() && shown > 0 && shown <= 4);
+	minmax_decimator copy = parts;
+	copy.flush(closed);
+	CHECK(closed.size() == tail.size() && std::equal(tail.begin(), tail.end(), closed.begin(), [](const xy_point& a, const xy_point& b) { return a.x == b.x && a.y == b.y; }));
+	parts.push(x.data() + cut, y.data() + cut, n - cut, out);
+	parts.flush(out);
+	CHECK(out.size() == ref.size());
+	bool same = out.size() == ref.size();
+	for (size_t i = 0; same && i < out.size(); ++i)
+		same = out[i].x == ref[i].x && out[i].y == ref[i].y;
+	CHECK(same);
+}
+
+// Фоновый расчёт кусками, в том числе отменённый и продолженный с state(), даёт точки R_K бит в бит
+static void test_async_job_bit_identical() {
+	std::vector<double> ref, ref_v, ref_t;
+	rk_point p = R_K(0, 200, 0.01, 3, 1, 3, ref, ref_v, ref_t);
+	std::vector<double> t, x, v;
+	{
+		rk_job job;
+		job.start(R_K_start(0, 0.01, 3, 1, 3), 200, 257);
+		job.wait();
+		job.take(t, x, v);
+		CHECK(job.done() && !job.cancelled() && job.progress() == 1);
+		CHECK(t == ref_t && x == ref && v == ref_v);
+		rk_state s = job.state();
+		CHECK(s.x == p.x && s.v == p.v && s.steps == ref.size());
+	}
+	t.clear();
+	x.clear();
+	v.clear();
+	rk_job job;
+	job.start(R_K_start(0, 0.01, 3, 1, 3), 200, 100);
+	while (job.progress() == 0 && !job.done()) {
+	}
+	job.cancel();
+	job.wait();
+	job.take(t, x, v);
+	rk_state s = job.state();
+	CHECK(s.steps == x.size());
+	job.start(s, 200, 1000);
+	job.wait();
+	job.take(t, x, v);
+	CHECK(t == ref_t && x == ref && v == ref_v);
+	// Разрушение работающего расчёта безопасно
+	rk_job* busy = new rk_job;
+	busy->start(R_K_start(0, 0.01, 3, 1, 3), 1e4, 64);
+	delete busy;
+}
+
+// Сетка t_k = begin + k h: число шагов не зависит от накопления t += h
+static void test_step_schedule() {
+	CHECK(R_K_steps(0, 10, 0.1) == 100);
+	CHECK(R_K_steps(0, 1, 0.3) == 4);
+	CHECK(R_K_steps(0.1, 0.7, 0.1) == 6);
+	CHECK(R_K_steps(-5, 5, 0.01) == 1000);
+	CHECK(R_K_steps(0, 0, 0.1) == 0 && R_K_steps(1, 0, 0.1) == 0 && R_K_steps(0, 1, 0) == 0);
+	CHECK(R_K_t(0, 0.1, 73) == 73 * 0.1);
+	std::vector<double> t;
+	R_K_times(0, 10, 0.1, t);
+	CHECK(t.size() == 100 && t.back() == 99 * 0.1);
+	std::vector<double> x, v, rt;
+	rk_point p = R_K(0, 10, 0.1, 3, 1, 3, x, v, rt);
+	CHECK(x.size() == 100 && v.size() == 100 && rt == t);
+	rk_point q = R_K_final(0, 10, 0.1, 3, 1, 3);
+	CHECK(p.x == q.x && p.v == q.v);
+	// Тот же шаг RK4 через таблицу Бутчера - те же узлы и то же число точек
+	std::vector<double> tx, tv;
+	R_K_tableau<tableau_rk4>(0, 10, 0.1, 3, 1, 3, tx, tv);
+	CHECK(tx.size() == x.size());
+	for (size_t k = 0; k < x.size(); ++k)
+		CHECK_NEAR(tx[k], x[k], 1e-12);
+	// Как и R_K, дописывает в конец, а не перезаписывает
+	std::vector<double> ax(1, -1.), av(2, -2.);
+	R_K_tableau<tableau_rk4>(0, 10, 0.1, 3, 1, 3, ax, av);
+	CHECK(ax.size() == 1 + tx.size() && av.size() == 2 + tv.size() && ax[0] == -1 && av[1] == -2);
+	CHECK(std::equal(tx.begin(), tx.end(), ax.begin() + 1) && std::equal(tv.begin(), tv.end(), av.begin() + 2));
+}
+
+// Кэш отдаёт начало более длинной траектории и досчитывает короткую бит в бит как R_K
+static void test_cache_prefix_bit_identical() {
+	rk_cache cache;
+	rk_key key = { 0, 0.01, 3, 1, 3 };
+	std::vector<double> x, v;
+	rk_state s;
+	cache.lookup(key, 40, x, v, s);
+	R_K_extend(s, 40, x, v);
+	cache.store(s, x, v);
+	std::vector<double> ref, ref_v;
+	R_K(0, 25.003, 0.01, 3, 1, 3, ref, ref_v);
+	cache.lookup(key, 25.003, x, v, s);
+	CHECK(x == ref && v == ref_v && s.steps == ref.size());
+	ref.clear();
+	ref_v.clear();
+	rk_point p = R_K(0, 70, 0.01, 3, 1, 3, ref, ref_v);
+	cache.lookup(key, 70, x, v, s);
+	CHECK(s.steps == R_K_steps(0, 40, 0.01));
+	R_K_extend(s, 70, x, v);
+	CHECK(x == ref && v == ref_v && s.x == p.x && s.v == p.v);
+}
+
+// Parareal: близко к R_K при ранней остановке, бит в бит при max_iter = числу отрезков;
+// возвращённое состояние - продолжение последней точки res на один шаг
+static void test_parareal_final_state() {
+	std::vector<double> ref, ref_v;
+	rk_point p = R_K(0, 100, 0.01, 3, 1, 3, ref, ref_v);
+	std::vector<double> x, v;
+	parareal_stats st;
+	rk_point q = R_K_parareal(0, 100, 0.01, 3, 1, 3, x, v, 4, 8, 10, 1e-10, 0, &st);
+	CHECK(st.iterations < st.slices);
+	CHECK(x.size() == ref.size());
+	for (size_t k = 0; k < x.size(); k += 97)
+		CHECK_NEAR(x[k], ref[k], 1e-8);
+	rk_point next = { x.back(), v.back() };
+	R_K_step(next.x, next.v, 0.01, 3, 3);
+	CHECK(q.x == next.x && q.v == next.v);
+	x.clear();
+	v.clear();
+	q = R_K_parareal(0, 100, 0.01, 3, 1, 3, x, v, 4, 8, 10, -1, 8, &st);
+	CHECK(st.iterations == 8);
+	CHECK(x == ref && v == ref_v && q.x == p.x && q.v == p.v);
+}
+
+// float и mixed против double на [0, 100], h = 0.01: у затухающих траекторий ошибка
+// порядка 1e-7, mixed точнее float; у слабо затухающих (lambda = 0.1) ошибка float копится
+// до 1e-4..1e-3, mixed остаётся на порядок точнее
+static void test_precision_accuracy() {
+	const double damped[][3] = { { 3, 1, 3 }, { 0.5, 1, 3 }, { 1, 0.5, 2 }, { 10, 1, 3 } };
+	for (size_t i = 0; i < sizeof(damped) / sizeof(damped[0]); ++i) {
+		double lambda = damped[i][0], x0dash = damped[i][1], N = damped[i][2];
+		rk_precision_report f = rk_precision_compare(0, 100, 0.01, lambda, x0dash, N, rk_prec_float);
+		rk_precision_report m = rk_precision_compare(0, 100, 0.01, lambda, x0dash, N, rk_prec_mixed);
+		CHECK(f.max_x > 0 && f.max_v > 0);
+		CHECK(f.max_x < 1e-6 && f.max_v < 1e-6 && f.rms_x < 1e-7 && f.rms_v < 1e-7);
+		CHECK(m.max_x < 2e-7 && m.max_v < 2e-7);
+		CHECK(m.rms_x <= f.rms_x && m.rms_v <= f.rms_v);
+		// Пакет во float (свой синус) - та же точность
+		std::vector<double> ref, ref_v;
+		rk_point p = R_K(0, 100, 0.01, lambda, x0dash, N, ref, ref_v);
+		rk_batch_f b;
+		b.add(0, (float)x0dash, (float)lambda, (float)N);
+		std::vector<float> bx, bv;
+		R_K_batch_f(0, 100, 0.01, b, bx, bv);
+		CHECK(bx.size() == ref.size());
+		for (size_t k = 0; k < bx.size(); k += 97) {
+			CHECK_NEAR(bx[k], ref[k], 1e-6);
+			CHECK_NEAR(bv[k], ref_v[k], 1e-6);
+		}
+		CHECK_NEAR(b.x[0], p.x, 1e-6);
+		CHECK_NEAR(b.v[0], p.v, 1e-6);
+	}
+	rk_precision_report f = rk_precision_compare(0, 100, 0.01, 0.1, 2, 5, rk_prec_float);
+	rk_precision_report m = rk_precision_compare(0, 100, 0.01, 0.1, 2, 5, rk_prec_mixed);
+	CHECK(f.max_x < 1e-3 && f.max_v < 1e-3);
+	CHECK(m.max_x * 10 < f.max_x && m.max_v * 10 < f.max_v);
+	rk_precision_report d = rk_precision_compare(0, 100, 0.01, 3, 1, 3, rk_prec_double);
+	CHECK(d.max_x == 0 && d.final_x == 0);
+}
+
+// Пакет из 4k + 3 траекторий: векторные ядра (16, 8 и 4 дорожки) и скалярный хвост дают те же
+// биты, что rk_batch_step1, в том числе при |N x| > 2^31 (четверть периода без переполнения);
+// от R_K (sin/cos из libm) отличие - на уровне округлений
+static void test_batch_lanes_match_scalar() {
+	const size_t n = 4 * 7 + 3, steps = 2000;
+	const double h = 0.01;
+	rk_batch b;
+	for (size_t i = 0; i < n; ++i)
+		b.add(0.1 * i, 1 + 0.05 * i, 0.125 * i, 1 + i % 4);
+	b.x[n - 2] = 3e9; // N x * 2/pi за пределами int32
+	b.x[5] = -7e9;
+	rk_batch ref = b;
+	std::vector<double> res(steps * n), res_v(steps * n);
+	R_K_batch_run(b, steps, h, res.data(), res_v.data());
+	for (size_t i = 0; i < n; ++i) {
+		double x = ref.x[i], v = ref.v[i];
+		bool same = true;
+		for (size_t k = 0; k < steps; ++k) {
+			same = same && res[k * n + i] == x && res_v[k * n + i] == v;
+			rk_batch_step1(x, v, h, ref.lambda[i], ref.N[i]);
+		}
+		CHECK(same && b.x[i] == x && b.v[i] == v);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		if (i == 5 || i == n - 2)
+			continue;
+		std::vector<double> rx, rv;
+		rk_point p = R_K(ref.x[i], ref.x[i] + steps * h, h, ref.lambda[i], ref.v[i], ref.N[i], rx, rv);
+		CHECK(rx.size() == steps);
+		double worst = 0;
+		for (size_t k = 0; k < steps; ++k)
+			worst = fmax(worst, fabs(res[k * n + i] - rx[k]) / (1 + fabs(rx[k])));
+		CHECK(worst <= 1e-12);
+		CHECK_NEAR(b.x[i], p.x, 1e-12 * (1 + fabs(p.x)));
+	}
+}
+
+// R_K_interleaved - те же биты, что R_K, парами (x, v); арена отдаёт NULL, когда места
+// не хватает, и после reset() раздаёт тот же буфер заново
+static void test_interleaved_and_arena() {
+	std::vector<double> x, v, xv;
+	rk_point p = R_K(0, 25, 0.01, 3, 1, 3, x, v);
+	rk_point q = R_K_interleaved(0, 25, 0.01, 3, 1, 3, xv);
+	CHECK(xv.size() == 2 * x.size());
+	bool same = true;
+	for (size_t k = 0; k < x.size(); ++k)
+		same = same && xv[2 * k] == x[k] && xv[2 * k + 1] == v[k];
+	CHECK(same && q.x == p.x && q.v == p.v);
+
+	size_t steps = R_K_steps(0, 25, 0.01);
+	rk_arena arena(2 * steps + 5);
+	CHECK(arena.capacity() == 2 * steps + 5);
+	double* a = arena.take(steps);
+	double* b = arena.take(steps);
+	CHECK(a && b && b == a + steps);
+	CHECK(arena.take(6) == NULL);
+	double* c = arena.take(5);
+	CHECK(c == b + steps && arena.take(1) == NULL);
+	R_K_into(0, 25, 0.01, 3, 1, 3, a, b);
+	CHECK(std::vector<double>(a, a + steps) == x && std::vector<double>(b, b + steps) == v);
+	arena.reset();
+	CHECK(arena.take(2 * steps + 5) == a && arena.take(1) == NULL);
+	arena.reset();
+	CHECK(arena.take(0) == a && arena.take(steps) == a);
+}
+
+// Сетки для проверок поиска отрезка: равномерная, равномерная с дрожанием до 0.2 шага
+// (тот же путь по формуле, но с поправкой ±1), неравномерная большая (таблица корзин)
+// и неравномерная малая (двоичный поиск)
+static std::vector<std::vector<double> > spline_test_grids() {
+	std::vector<std::vector<double> > g(4);
+	for (size_t i = 0; i < 1000; ++i) {
+		g[0].push_back(-3 + i * 0.01);
+		g[1].push_back(-3 + i * 0.01 + 0.002 * sin(i * 2.3));
+		g[2].push_back(-3 + 0.5 * i / 999. + 10. * i * i / (999. * 999.));
+	}
+	for (size_t i = 0; i < 20; ++i)
+		g[3].push_back(i * i * 0.1);
+	return g;
+}
+
+// Точки запроса: внутри отрезков, ровно в узлах, левее первого, правее последнего и NaN
+static std::vector<double> spline_test_queries(const std::vector<double>& xs) {
+	std::vector<double> q;
+	double lo = xs.front(), hi = xs.back();
+	for (size_t i = 0; i < xs.size(); ++i)
+		q.push_back(xs[i]);
+	for (size_t i = 0; i < 3000; ++i)
+		q.push_back(lo + (hi - lo) * (0.5 + 0.5 * sin(i * 0.37)));
+	q.push_back(lo - 1);
+	q.push_back(lo - 1e-300);
+	q.push_back(std::nextafter(lo, -1e300));
+	q.push_back(hi + 1);
+	q.push_back(std::nextafter(hi, 1e300));
+	q.push_back(std::numeric_limits<double>::quiet_NaN());
+	q.push_back(-std::numeric_limits<double>::infinity());
+	q.push_back(std::numeric_limits<double>::infinity());
+	return q;
+}
+
+static bool same_value(double a, double b) {
+	return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+// Пакетный f - по отсортированным точкам слиянием, по прочим поиском, значения по 4 через
+// gather - даёт те же биты, что одиночный f, на всех видах сеток и для любых точек
+static void test_spline_batch_matches_scalar() {
+	std::vector<std::vector<double> > grids = spline_test_grids();
+	for (size_t g = 0; g < grids.size(); ++g) {
+		const std::vector<double>& xs = grids[g];
+		std::vector<double> ys(xs.size());
+		for (size_t i = 0; i < xs.size(); ++i)
+			ys[i] = sin(3 * xs[i]) + 0.1 * xs[i] * xs[i];
+		cubic_spline s;
+		s.build_spline(xs.data(), ys.data(), xs.size());
+		std::vector<double> q = spline_test_queries(xs);
+		std::vector<double> sorted;
+		for (size_t i = 0; i < q.size(); ++i)
+			if (!std::isnan(q[i]))
+				sorted.push_back(q[i]);
+		std::sort(sorted.begin(), sorted.end());
+		const std::vector<double>* sets[] = { &q, &sorted };
+		for (int k = 0; k < 2; ++k) {
+			const std::vector<double>& p = *sets[k];
+			std::vector<double> out(p.size());
+			s.f(p.data(), out.data(), p.size());
+			bool same = true;
+			for (size_t i = 0; i < p.size(); ++i)
+				same = same && same_value(out[i], s.f(p[i]));
+			CHECK(same);
+			// Длина не кратна 4 и меньше порции - хвост eval без gather
+			s.f(p.data() + 1, out.data(), 7);
+			for (size_t i = 0; i < 7; ++i)
+				CHECK(same_value(out[i], s.f(p[1 + i])));
+		}
+	}
+}
+
+// Номер отрезка по формуле (равномерная сетка) и по таблице корзин с поправкой ±1 -
+// тот же, что даёт двоичный поиск xs[j - 1] < x <= xs[j], в том числе в узлах и рядом с ними
+static void test_spline_segment_matches_binary_search() {
+	std::vector<std::vector<double> > grids = spline_test_grids();
+	for (size_t g = 0; g < grids.size(); ++g) {
+		const std::vector<double>& xs = grids[g];
+		const size_t n = xs.size();
+		std::vector<double> ys(n, 1.);
+		cubic_spline s;
+		CHECK(s.segment(0) == 0);
+		s.build_spline(xs.data(), ys.data(), n);
+		std::vector<double> q = spline_test_queries(xs);
+		for (size_t i = 0; i < n; ++i) {
+			q.push_back(std::nextafter(xs[i], -1e300));
+			q.push_back(std::nextafter(xs[i], 1e300));
+		}
+		size_t wrong = 0;
+		for (size_t i = 0; i < q.size(); ++i) {
+			size_t j = s.segment(q[i]);
+			if (std::isnan(q[i])) {
+				wrong += !(j >= 1 && j <= n - 1);
+				continue;
+			}
+			size_t ref = std::lower_bound(xs.begin(), xs.end(), q[i]) - xs.begin();
+			ref = ref < 1 ? 1 : ref > n - 1 ? n - 1 : ref;
+			wrong += j != ref;
+		}
+		CHECK(wrong == 0);
+	}
+}
+
+// reserve на построенном сплайне сохраняет его (те же биты f), неудачное выделение
+// памяти оставляет сплайн прежним
+static void test_spline_reserve_keeps_spline() {
+	std::vector<double> x, y;
+	for (size_t i = 0; i < 300; ++i) {
+		x.push_back(i * 0.1 + 0.03 * sin(i * 1.3));
+		y.push_back(cos(x.back()));
+	}
+	cubic_spline s;
+	s.reserve(10);
+	s.build_spline(x.data(), y.data(), x.size());
+	std::vector<double> q, before;
+	for (size_t i = 0; i < 1000; ++i) {
+		q.push_back(-1 + i * 0.032);
+		before.push_back(s.f(q.back()));
+	}
+	s.reserve(100);
+	s.reserve(5000);
+	bool same = true;
+	for (size_t i = 0; i < q.size(); ++i)
+		same = same && s.f(q[i]) == before[i];
+	CHECK(same);
+	bool thrown = false;
+	try {
+		s.reserve(std::numeric_limits<size_t>::max() / 4);
+	}
+	catch (const std::bad_alloc&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+	for (size_t i = 0; i < q.size(); ++i)
+		same = same && s.f(q[i]) == before[i];
+	CHECK(same);
+	// Копия и перестроение после reserve - как обычно
+	cubic_spline c = s;
+	CHECK(c.f(q[500]) == before[500]);
+	s.build_spline(x.data(), y.data(), 50);
+	CHECK(s.f(x[10]) == y[10] || fabs(s.f(x[10]) - y[10]) < 1e-15);
+}
+
+// Период маятника без затухания (lambda = 0) из x = 0 со скоростью v0: 4 K(v0 / 2),
+// K = pi / (2 AGM(1, sqrt(1 - k^2)))
+static double pendulum_period(double v0) {
+	double k = v0 / 2, a = 1, b = sqrt(1 - k * k);
+	for (int i = 0; i < 20; ++i) {
+		double m = (a + b) / 2;
+		b = sqrt(a * b);
+		a = m;
+	}
+	return 2 * acos(-1.0) / a;
+}
+
+// События: x = 0 и v = 0 у маятника без затухания - в известные моменты (период по AGM и
+// мелкошаговый R_K), фильтр направления оставляет только свои пересечения, а терминальное
+// событие обрывает интегрирование на себе
+static void test_events_known_crossings() {
+	const double v0 = 1, T = pendulum_period(v0);
+	// Мелкий шаг: первая смена знака x после t = 0 - в T / 2
+	std::vector<double> fx, fv, ft;
+	R_K(0, T, 1e-5, 0, v0, 3, fx, fv, ft);
+	double t_ref = 0;
+	for (size_t k = 1; k < fx.size(); ++k)
+		if (fx[k - 1] > 0 && fx[k] <= 0) {
+			t_ref = ft[k - 1] + (ft[k] - ft[k - 1]) * fx[k - 1] / (fx[k - 1] - fx[k]);
+			break;
+		}
+	CHECK_NEAR(t_ref, T / 2, 1e-9);
+
+	rk_event any[] = { rk_make_event(ev_x_2pi) };
+	std::vector<rk_event_hit> hits;
+	double t_stop = -1;
+	rk_point p = R_K_events(0, 4.75 * T, 0.01, 0, v0, 3, any, 1, hits, &t_stop);
+	// x = 0 в T / 2, T, 3T / 2, ... (x = 0 в начале - не событие)
+	CHECK(hits.size() == 9);
+	for (size_t i = 0; i < hits.size(); ++i) {
+		CHECK(hits[i].event == 0);
+		CHECK_NEAR(hits[i].t, (i + 1) * T / 2, 1e-8);
+		CHECK_NEAR(hits[i].x, 0, 1e-8);
+		CHECK_NEAR(fabs(hits[i].v), v0, 1e-8);
+	}
+	CHECK_NEAR(hits[0].t, t_ref, 1e-8);
+	CHECK(t_stop == R_K_t(0, 0.01, R_K_steps(0, 4.75 * T, 0.01)));
+	std::vector<double> x, v;
+	rk_point q = R_K(0, 4.75 * T, 0.01, 0, v0, 3, x, v);
+	CHECK(p.x == q.x && p.v == q.v);
+
+	// Направление: +1 - только рост x (T, 2T, ...), -1 - только убывание (T / 2, 3T / 2, ...)
+	rk_event dir[] = { rk_make_event(ev_x_2pi, 1), rk_make_event(ev_x_2pi, -1), rk_make_event(ev_v_zero, -1) };
+	hits.clear();
+	R_K_events(0, 4.75 * T, 0.01, 0, v0, 3, dir, 3, hits);
+	size_t n[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < hits.size(); ++i) {
+		++n[hits[i].event];
+		CHECK(i == 0 || hits[i - 1].t <= hits[i].t);
+		if (hits[i].event == 0) {
+			CHECK(hits[i].v > 0);
+			CHECK_NEAR(hits[i].t, n[0] * T, 1e-8);
+		}
+		else if (hits[i].event == 1) {
+			CHECK(hits[i].v < 0);
+			CHECK_NEAR(hits[i].t, (2 * n[1] - 1) * T / 2, 1e-8);
+		}
+		else {
+			// v = 0 с убыванием v - наибольшее отклонение x > 0, в T / 4 + k T
+			CHECK(hits[i].x > 0);
+			CHECK_NEAR(hits[i].t, (n[2] - 0.75) * T, 1e-8);
+			CHECK_NEAR(hits[i].v, 0, 1e-8);
+		}
+	}
+	CHECK(n[0] == 4 && n[1] == 5 && n[2] == 5);
+
+	// Терминальное событие: второй нуль x, дальше не интегрируем
+	rk_event stop[] = { rk_make_event(ev_v_zero), rk_make_event(ev_x_2pi, 1, true) };
+	hits.clear();
+	p = R_K_events(0, 4.75 * T, 0.01, 0, v0, 3, stop, 2, hits, &t_stop);
+	CHECK(hits.size() == 3);
+	CHECK(hits.back().event == 1);
+	CHECK_NEAR(hits.back().t, T, 1e-8);
+	CHECK(t_stop == hits.back().t && p.x == hits.back().x && p.v == hits.back().v);
+	CHECK_NEAR(hits[0].t, T / 4, 1e-8);
+	CHECK_NEAR(hits[1].t, 3 * T / 4, 1e-8);
+}
+
+// Наибольшая ошибка rk_dense с шагом h в серединах шагов по сравнению с мелкошаговым ref
+static double dense_mid_error(const rk_dense& ref, double h) {
+	rk_dense d = R_K_dense(0, 10, h, 3, 1, 3);
+	double worst = 0;
+	for (size_t k = 0; k + 1 < d.size(); ++k) {
+		double t = R_K_t(0, h, k) + h / 2;
+		worst = fmax(worst, fabs(d.x(t) - ref.x(t)));
+		worst = fmax(worst, fabs(d.v(t) - ref.v(t)));
+	}
+	return worst;
+}
+
+// Плотный вывод: в узлах - ровно точки R_K, между узлами ошибка O(h^4) (вдвое меньший
+// шаг - примерно в 16 раз меньше), номер шага по (t - begin) / h верен у обоих концов
+// и около каждого узла - сверяется с линейным поиском
+static void test_dense_nodes_order_and_lookup() {
+	const double begin = 0.3, h = 0.1;
+	std::vector<double> res, res_v;
+	rk_point p = R_K(begin, 7.3, h, 3, 1, 3, res, res_v);
+	rk_dense d = R_K_dense(begin, 7.3, h, 3, 1, 3);
+	CHECK(d.size() == res.size() + 1);
+	CHECK(d.t_begin() == begin && d.t_end() == R_K_t(begin, h, res.size()));
+	for (size_t k = 0; k < res.size(); ++k)
+		CHECK(d.x(R_K_t(begin, h, k)) == res[k] && d.v(R_K_t(begin, h, k)) == res_v[k]);
+	CHECK(d.x(d.t_end()) == p.x && d.v(d.t_end()) == p.v);
+	CHECK(d.x(begin - 1) == res[0] && d.v(begin - 1) == res_v[0]);
+	CHECK(d.x(d.t_end() + 1) == p.x && d.v(d.t_end() + 1) == p.v);
+
+	std::vector<double> ts;
+	for (size_t k = 0; k <= res.size(); ++k) {
+		double tk = R_K_t(begin, h, k);
+		ts.push_back(nextafter(tk, -1e300));
+		ts.push_back(nextafter(tk, 1e300));
+		ts.push_back(tk + 0.37 * h);
+	}
+	std::vector<double> xs(ts.size()), vs(ts.size());
+	d.eval(ts.data(), ts.size(), xs.data(), vs.data());
+	size_t last = res.size() - 1;
+	bool same = true;
+	for (size_t i = 0; i < ts.size(); ++i) {
+		double t = ts[i];
+		if (t < begin || t > d.t_end())
+			continue;
+		size_t k = 0;
+		while (k < last && R_K_t(begin, h, k + 1) <= t)
+			++k;
+		double x0 = res[k], v0 = res_v[k];
+		double x1 = k < last ? res[k + 1] : p.x, v1 = k < last ? res_v[k + 1] : p.v;
+		double x, v;
+		rk_hermite((t - R_K_t(begin, h, k)) / h, h, x0, v0, func(v0, x0, 3, 3), x1, v1, func(v1, x1, 3, 3), x, v);
+		same = same && xs[i] == x && vs[i] == v;
+	}
+	CHECK(same);
+
+	rk_dense ref = R_K_dense(0, 10, 1e-3, 3, 1, 3);
+	double e1 = dense_mid_error(ref, 0.05), e2 = dense_mid_error(ref, 0.025);
+	CHECK(e1 < 1e-4 && e1 / e2 > 12 && e1 / e2 < 20);
+}
+
+// Показатели Ляпунова: якобиан - центральные разности func, касательный шаг - центральные
+// разности R_K_step; сумма показателей - среднее fv = -lambda cos(N x) вдоль траектории;
+// FLI не растёт у либрации без затухания (lambda = 0) и растёт ~T у седла x = pi.
+// Система плоская и автономная, хаоса в ней нет - седло здесь самый неустойчивый режим
+static void test_lyapunov_jacobian_sum_and_fli() {
+	const double e = 1e-6;
+	for (int i = 0; i < 20; ++i) {
+		double x = -3 + 0.31 * i, v = 2 * sin(1.3 * i), lambda = 0.5 * (i % 7) - 1, N = 1 + i % 5;
+		double fx, fv;
+		rk_jacobian(x, v, lambda, N, fx, fv);
+		CHECK_NEAR(fx, (func(v, x + e, lambda, N) - func(v, x - e, lambda, N)) / (2 * e), 1e-8 * (1 + fabs(fx)));
+		CHECK_NEAR(fv, (func(v + e, x, lambda, N) - func(v - e, x, lambda, N)) / (2 * e), 1e-8 * (1 + fabs(fv)));
+
+		double w[2][2] = { { 1, 0 }, { 0, 1 } }, tx = x, tv = v;
+		R_K_tangent_step(tx, tv, w, 0.05, lambda, N);
+		double xp = x + e, vp = v, xm = x - e, vm = v;
+		R_K_step(xp, vp, 0.05, lambda, N);
+		R_K_step(xm, vm, 0.05, lambda, N);
+		CHECK_NEAR(w[0][0], (xp - xm) / (2 * e), 1e-8);
+		CHECK_NEAR(w[0][1], (vp - vm) / (2 * e), 1e-8);
+		xp = x, vp = v + e, xm = x, vm = v - e;
+		R_K_step(xp, vp, 0.05, lambda, N);
+		R_K_step(xm, vm, 0.05, lambda, N);
+		CHECK_NEAR(w[1][0], (xp - xm) / (2 * e), 1e-8);
+		CHECK_NEAR(w[1][1], (vp - vm) / (2 * e), 1e-8);
+	}
+
+	// На предельном цикле: l1 + l2 - среднее fv по точкам той же траектории R_K
+	std::vector<double> x, v;
+	R_K(0, 200, 0.01, 3, 2, 3, x, v);
+	double mean = 0;
+	for (size_t k = 0; k < x.size(); ++k)
+		mean += -3 * cos(3 * x[k]);
+	mean /= x.size();
+	double l1, l2;
+	rk_lyapunov s = R_K_lyapunov(0, 200, 0.01, 3, 2, 3);
+	lyapunov_exponents(s, l1, l2);
+	CHECK(l1 >= l2);
+	CHECK_NEAR(l1 + l2, mean, 1e-3);
+
+	// lambda = 0, либрация: FLI ограничен и с ростом T не меняется
+	rk_lyapunov a = R_K_lyapunov(0, 100, 0.01, 0, 1, 3), b = R_K_lyapunov(0, 400, 0.01, 0, 1, 3);
+	CHECK(lyapunov_fli(a) < 1 && lyapunov_fli(b) == lyapunov_fli(a));
+	lyapunov_exponents(b, l1, l2);
+	CHECK(fabs(l1) < 1e-3 && fabs(l1 + l2) < 1e-9);
+
+	// Седло x = pi (begin = pi, v = 0): w1 = (cosh t, sinh t), FLI = t - ln 2 / 2
+	const double pi = acos(-1.0);
+	rk_lyapunov c = R_K_lyapunov(pi, pi + 10, 0.01, 0, 0, 3), d = R_K_lyapunov(pi, pi + 20, 0.01, 0, 0, 3);
+	CHECK_NEAR(lyapunov_fli(c), 10 - log(2.0) / 2, 0.01);
+	CHECK_NEAR(lyapunov_fli(d) - lyapunov_fli(c), 10, 0.01);
+	lyapunov_exponents(d, l1, l2);
+	CHECK_NEAR(l1, 1, 0.05);
+}
+
+// Кэш на диске: новый rk_cache с тем же каталогом отдаёт траекторию из файла бит в бит;
+// traj_read читает те же точки, что traj_file; файл с чужим порядком байтов не читается
+static void test_cache_disk_tier() {
+	rk_key key = { 0, 0.01, 3, 1, 3 };
+	std::vector<double> ref, ref_v;
+	R_K(0, 40, 0.01, 3, 1, 3, ref, ref_v);
+	{
+		rk_cache cache;
+		cache.set_dir(".");
+		std::vector<double> x, v;
+		cache.get(key, 40, x, v);
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "./%016llx.rktr", (unsigned long long)rk_key_hash(key));
+
+	rk_cache cache;
+	cache.set_dir(".");
+	std::vector<double> x, v;
+	rk_state s;
+	CHECK(cache.lookup(key, 25.003, x, v, s) == R_K_steps(0, 25.003, 0.01));
+	CHECK(cache.hit_count() == 1 && std::equal(x.begin(), x.end(), ref.begin()) && std::equal(v.begin(), v.end(), ref_v.begin()));
+	CHECK(cache.lookup(key, 70, x, v, s) == ref.size());
+	CHECK(x == ref && v == ref_v && s.steps == ref.size());
+
+	traj_header hd;
+	std::vector<double> ft, fx, fv, mt, mx, mv;
+	CHECK(traj_read(name, hd, &ft, &fx, NULL));
+	CHECK(hd.count == ref.size() && hd.byte_order == traj_byte_order && fx == ref);
+	traj_file f;
+	CHECK(f.open(name));
+	f.read_all(mt, mx, mv);
+	CHECK(ft == mt && fx == mx);
+	f.close();
+
+	// Байты отметки в обратном порядке - как у файла с машины с другим порядком байтов
+	std::fstream io(name, std::ios::in | std::ios::out | std::ios::binary);
+	char mark[4];
+	io.seekg(12);
+	io.read(mark, 4);
+	std::reverse(mark, mark + 4);
+	io.seekp(12);
+	io.write(mark, 4);
+	io.close();
+	CHECK(!traj_read(name, hd, NULL, &fx, &fv));
+	CHECK(!f.open(name));
+	rk_cache other;
+	other.set_dir(".");
+	CHECK(other.lookup(key, 40, x, v, s) == 0 && other.miss_count() == 1);
+	remove(name);
+}
+
+#if defined(VM_RK_TRACE)
+// Счётчики правых частей и шагов у всех путей интегрирования, не только у R_K
+static void test_trace_counts_every_path() {
+	std::vector<double> x, v;
+	rk_trace_reset();
+	R_K(0, 10, 0.01, 3, 1, 3, x, v);
+	CHECK(rk_trace_count(rk_count_steps) == 1000 && rk_trace_count(rk_count_rhs) == 4000);
+	rk_trace_reset();
+	R_K_symplectic(0, 10, 0.01, 3, 1, 3, x, v, rk_yoshida4);
+	CHECK(rk_trace_count(rk_count_steps) == 1000 && rk_trace_count(rk_count_rhs) == 3000);
+	rk_trace_reset();
+	R_K_final_p(0, 10, 0.01, 3, 1, 3, rk_prec_float);
+	CHECK(rk_trace_count(rk_count_steps) == 1000 && rk_trace_count(rk_count_rhs) == 4000);
+	rk_trace_reset();
+	R_K_parareal(0, 10, 0.01, 3, 1, 3, x, v, 2, 4);
+	CHECK(rk_trace_count(rk_count_steps) > 1000 && rk_trace_count(rk_count_rhs) == 4 * rk_trace_count(rk_count_steps));
+	rk_trace_reset();
+	rk_batch_f b;
+	for (int i = 0; i < 19; ++i)
+		b.add(0, 1, 0.5f * i, 3);
+	std::vector<float> bx, bv;
+	R_K_batch_f(0, 10, 0.01, b, bx, bv);
+	CHECK(rk_trace_count(rk_count_steps) == 19000 && rk_trace_count(rk_count_rhs) == 76000);
+	rk_trace_reset();
+	dp_stats st = R_K_DP(0, 10, 0.01, 3, 1, 3, x, v);
+	CHECK(rk_trace_count(rk_count_rhs) == st.nfev && rk_trace_count(rk_count_steps) == st.naccept);
+}
+#endif
+
+// Наибольшее отличие spline_stream от build_spline по тем же узлам - в узлах и серединах отрезков
+static double spline_stream_gap(const std::vector<double>& x, const std::vector<double>& y, size_t window) {
+	cubic_spline s;
+	s.set_threads(1);
+	s.build_spline(x.data(), y.data(), x.size());
+	spline_stream st(window);
+	for (size_t i = 0; i < x.size(); ++i)
+		st.push(x[i], y[i]);
+	double worst = 0;
+	for (size_t i = 0; i + 1 < x.size(); ++i) {
+		double q = 0.5 * (x[i] + x[i + 1]);
+		worst = fmax(worst, fabs(st.f(x[i]) - s.f(x[i])));
+		worst = fmax(worst, fabs(st.f(q) - s.f(q)));
+	}
+	return worst;
+}
+
+// Потоковый сплайн по точкам R_K: с окном 48 - ровно build_spline на равномерной и
+// неравномерной сетке, с окном 16 - в пределах 1e-12; пачка совпадает с поточечным
+// добавлением; с max_knots память ограничена, а оставшиеся отрезки те же.
+// Почему ровно: прямой ход у обоих считается по тем же формулам в том же порядке, так что
+// alpha и beta совпадают бит в бит. Обратный ход потока начинается с c = 0 на тогдашнем
+// последнем узле, и отличие c от build_spline затухает назад в |alpha| (~0.27) раз за узел.
+// Как только оно меньше половины ulp, alpha c + beta округляется в то же число, и дальше
+// назад c совпадают точно; 0.27^48 ~ 1e-27 - далеко за 2^-53
+static void test_spline_stream_matches_build() {
+	std::vector<double> x, v, t;
+	R_K(0, 100, 0.01, 3, 1, 3, x, v, t);
+	std::vector<double> tn(t.size());
+	double a = 0;
+	for (size_t i = 0; i < tn.size(); ++i) {
+		tn[i] = a;
+		a += 0.011 + 0.009 * sin(i * 1.7);
+	}
+	CHECK(spline_stream_gap(t, x, 48) == 0);
+	CHECK(spline_stream_gap(tn, x, 48) == 0);
+	CHECK(spline_stream_gap(t, x, 16) <= 1e-12);
+	CHECK(spline_stream_gap(tn, x, 16) <= 1e-12);
+
+	spline_stream one(16), batch(16);
+	for (size_t i = 0; i < t.size(); ++i)
+		one.push(t[i], x[i]);
+	CHECK(batch.push(t.data(), x.data(), t.size()) == t.size());
+	for (size_t i = 0; i + 1 < t.size(); i += 13) {
+		double q = 0.5 * (t[i] + t[i + 1]);
+		CHECK_NEAR(batch.f(q), one.f(q), 1e-12);
+	}
+	CHECK(!one.push(t[5], 0) && one.size() == t.size());
+
+	spline_stream full(48), capped(48, 1000);
+	for (size_t i = 0; i < t.size(); ++i) {
+		full.push(t[i], x[i]);
+		capped.push(t[i], x[i]);
+		CHECK(capped.size() <= 1000);
+	}
+	CHECK(capped.size() + capped.dropped() == t.size());
+	CHECK(capped.x_end() == t.back() && capped.x_begin() == t[t.size() - capped.size()]);
+	for (size_t i = t.size() - capped.size(); i + 1 < t.size(); i += 7) {
+		double q = 0.5 * (t[i] + t[i + 1]);
+		CHECK(capped.f(q) == full.f(q));
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* filter = argc > 1 ? argv[1] : NULL;
+	const test_case cases[] = {
+		{ "dp_matches_rk4", test_dp_matches_rk4 },
+		{ "dp_fails_instead_of_hanging", test_dp_fails_instead_of_hanging },
+		{ "sweep_covers_grid", test_sweep_covers_grid },
+		{ "resume_bit_identical", test_resume_bit_identical },
+		{ "checkpoint_rejects_bad_input", test_checkpoint_rejects_bad_input },
+		{ "output_txt_layout", test_output_txt_layout },
+		{ "traj_writer_guards", test_traj_writer_guards },
+		{ "spline_vector_moves", test_spline_vector_moves },
+		{ "parallel_spline_matches_serial", test_parallel_spline_matches_serial },
+		{ "symplectic_energy_bounded", test_symplectic_energy_bounded },
+		{ "decimate_column_count", test_decimate_column_count },
+		{ "decimate_peek_continues_column", test_decimate_peek_continues_column },
+		{ "async_job_bit_identical", test_async_job_bit_identical },
+		{ "step_schedule", test_step_schedule },
+		{ "cache_prefix_bit_identical", test_cache_prefix_bit_identical },
+		{ "parareal_final_state", test_parareal_final_state },
+		{ "precision_accuracy", test_precision_accuracy },
+		{ "spline_stream_matches_build", test_spline_stream_matches_build },
+		{ "batch_lanes_match_scalar", test_batch_lanes_match_scalar },
+		{ "interleaved_and_arena", test_interleaved_and_arena },
+		{ "spline_batch_matches_scalar", test_spline_batch_matches_scalar },
+		{ "spline_segment_matches_binary_search", test_spline_segment_matches_binary_search },
+		{ "spline_reserve_keeps_spline", test_spline_reserve_keeps_spline },
+		{ "events_known_crossings", test_events_known_crossings },
+		{ "dense_nodes_order_and_lookup", test_dense_nodes_order_and_lookup },
+		{ "lyapunov_jacobian_sum_and_fli", test_lyapunov_jacobian_sum_and_fli },
+		{ "cache_disk_tier", test_cache_disk_tier },
+#if defined(VM_RK_TRACE)
+		{ "trace_counts_every_path", test_trace_counts_every_path },
+#endif
+	};
+	int failed_cases = 0, run = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		if (filter && !strstr(cases[i].name, filter))
+			continue;
+		int before = failures;
+		cases[i].body();
+		++run;
+		bool ok = failures == before;
+		failed_cases += !ok;
+		printf("%-40s %s\n", cases[i].name, ok ? "ok" : "FAILED");
+	}
+	printf("%d of %d cases failed\n", failed_cases, run);
+	return failed_cases ? 1 : 0;
+}